@@ -40,6 +40,19 @@ Install-Package Assimp -version 3.0.0
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "frameuniforms.h"
+#include "frustum.h"
+#include "timestep.h"
+#include "ballsystem.h"
+#include "ccd.h"
+#include "shotplanner.h"
+#include "replay.h"
+#include "profiler.h"
+#include "gpuprofiler.h"
+#include "postprocess.h"
+#include "headless.h"
+#include "framecapture.h"
+#include "simthread.h"
 
 // GLEW
 #include <GL/glew.h>
@@ -64,20 +77,171 @@ GLdouble cameraPos = 200.0f;
 Camera camera(glm::vec3(0.0f, 0.0f, 200.0f));
 
 
-GLfloat poolBallAngle = 0.0f;
-GLfloat poolBall2Angle = 0.0f;
+// Physics clock - the balls are simulated at a fixed rate, independent of the frame rate
+FixedTimestep physicsClock(PHYSICS_HZ, PHYSICS_MAX_STEPS);
+
+
+// Every pool ball on the table (structure-of-arrays physics, see ballsystem.h)
+BallSystem poolBalls;
+
+// Event-driven continuous collision detection (toggle with C)
+EventDrivenSimulator poolBallsCCD;
+bool useCCD = false;
+
+// Set while the shot planner is searching (P); no other shot is planned until its result arrives
+bool shotPending = false;
+
+// Replay recording (toggle with R) and scrubbing (LEFT/RIGHT jump 5 seconds)
+ReplayRecorder replayRecorder;
+ReplayReader replayReader;
+long long physicsTick = 0;
+long long replayTick = 0;
+
+// Runs the physics above on its own thread and hands the renderer snapshots of it.
+// Everything in this block belongs to that thread once it starts: change it with simulation.Post().
+SimulationThread simulation;
+GLdouble lastPhysicsTime = 0.0;
+
+// Every draw of the frame goes through here so it can be sorted by state (I prints stats)
+RenderQueue renderQueue;
+
+// World-space spheres of everything drawn this frame, culled against the view before submitting
+FrustumCuller sceneCuller;
+
+// Offscreen scene targets and the edge-detection passes (E toggles, [ and ] halve/double the edge resolution)
+PostProcess postProcess;
+
+// Set above zero to replace the rack with this many randomly moving balls
+const int STRESS_BALL_COUNT = 0;
+
+// Ball n (0 is the cue ball) wears <n>Ball.png where there is one; past the last, the numbers repeat
+const int POOL_BALL_TEXTURES = 16;
 
 //================================Jonathan Drakes======================================
 
 //===================== Protoype function for call back  ==============================
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int modes);
-void mouseClickedCallback(GLFWwindow* window, int button, int  action, int mode);
 void clickDragCallback(GLFWwindow* window, int button, int  action, int mode);
 //=====================================================================================
 
+// Seconds since start: the window's clock, or the fixed headless one
+GLdouble appTime()
+{
+    return headless.Options.Enabled ? headless.Time() : glfwGetTime();
+}
+
+
+// Finishes the match recording and opens it for scrubbing (simulation thread)
+void stopReplayRecording()
+{
+    replayRecorder.Stop();
+    cout << "\nStopped recording (" << replayRecorder.TicksRecorded << " ticks, "
+         << replayRecorder.TicksDropped << " dropped)\n";
+    if (replayReader.Open("match"))
+        replayTick = replayReader.LastTick;
+}
+
+
+// Prints the planner's best shots and plays the first, provided the table and physics mode are
+// still the ones it was planned for (simulation thread)
+void playBestShot(const vector<ShotResult>& best, const BallSystem& planned,
+                  const ShotSearchSettings& search, long long cutOff)
+{
+    shotPending = false;
+    cout << "\nBest shots (" << search.CandidateCount() << " candidates, "
+         << cutOff << " cut off so far):\n";
+    for (size_t i = 0; i < best.size(); i++)
+        cout << "  angle " << best[i].Shot.Angle << "  power " << best[i].Shot.Power
+             << "  spin " << best[i].Shot.Spin << "  score " << best[i].Score << "\n";
+    if (best.empty())
+        return;
+
+    if (poolBalls.X != planned.X || poolBalls.Y != planned.Y ||
+        poolBalls.VX != planned.VX || poolBalls.VY != planned.VY || useCCD != search.UseCCD)
+    {
+        cout << "\nThe table changed while planning; the shot was not played\n";
+        return;
+    }
+    ShotParams shot = best[0].Shot;
+    poolBalls.Strike(shot.Angle, shot.Power, shot.Spin);
+    poolBallsCCD.Reset();
+}
+
+
+// Runs the physics ticks due by `now` and publishes the table for the renderer.
+// Returns the seconds until the next tick is due.
+GLdouble simulate(GLdouble now)
+{
+    // Run as many fixed physics ticks as the elapsed real time calls for
+    int physicsSteps = physicsClock.Advance(now - lastPhysicsTime);
+    lastPhysicsTime = now;
+
+    for (int step = 0; step < physicsSteps; step++)
+    {
+        PROFILE_SCOPE("Physics tick");
+        if (useCCD)
+            poolBallsCCD.Step(poolBalls, physicsClock.Dt);
+        else
+            poolBalls.Step((GLfloat)physicsClock.Dt);
+
+        replayRecorder.RecordTick(physicsTick++, poolBalls);
+    }
+
+    if (physicsSteps > 0 || physicsTick == 0)
+    {
+        SceneSnapshot& snapshot = simulation.Snapshots.Write();
+        snapshot.CopyFrom(poolBalls);
+        snapshot.Tick = physicsTick;
+        snapshot.TickTime = now - physicsClock.Accumulator;
+        snapshot.Dt = physicsClock.Dt;
+        simulation.Snapshots.Publish();
+    }
+    return physicsClock.Dt - physicsClock.Accumulator;
+}
+
+
+// No window: a context from EGL/OSMesa and an offscreen target (see headless.h)
+void init_Headless()
+{
+    if (headless.Options.Width > 0 && headless.Options.Height > 0)
+        {
+            sWidth = headless.Options.Width;
+            sHeight = headless.Options.Height;
+        }
+
+    if (!headless.CreateContext(sWidth, sHeight))
+        {
+            cout << "\nFailed to create a headless OpenGL context...";
+            exit(EXIT_FAILURE);
+        }
+
+    // GLEW finds the core functions, then fails looking for GLX with no X display; that's fine here
+    glewExperimental = GL_TRUE;
+    GLenum result = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (result == GLEW_ERROR_NO_GLX_DISPLAY)
+        result = GLEW_OK;
+#endif
+    if (result != GLEW_OK)
+        {
+            cout << "\nFailed to initialize GLEW...";
+            exit(EXIT_FAILURE);
+        }
+
+    headless.CreateTarget(sWidth, sHeight);
+    glEnable(GL_DEPTH_TEST);
+}
+
+
 void init_Resources()
 {
+    if (headless.Options.Enabled)
+        {
+            init_Headless();
+            return;
+        }
+
     // Initialize the resources - set window, etc.
     if (!glfwInit())
         {
@@ -126,8 +290,7 @@ void init_Resources()
  // Registering the call-back function for the keyboard
  //-----------------------------------------------------
     glfwSetKeyCallback(window, keyboardCallback);
-    glfwSetMouseButtonCallback(window, mouseClickedCallback);
-    glfwSetCursorPosCallback ( window, clickDrag_callback );
+    glfwSetMouseButtonCallback(window, clickDragCallback);
     glfwSetScrollCallback(window, scroll_callback);     //scroll on mouse to zoom in or out
 
     // Setup OpenGL options
@@ -139,7 +302,7 @@ void init_Resources()
 // ============ Call back function for the keyboard =================
 // ==================================================================
     
-void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int modes)
+void keyboardCallback(GLFWwindow* window, int key, int /*scancode*/, int action, int modes)
 {
         //If ESC us pressed, close the window
         if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
@@ -147,10 +310,186 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
             glfwSetWindowShouldClose(window, GL_TRUE);
             return;
         }
+
+        //Camera Manipulation
+        //
+        //Zoom Out
+        if (GLFW_KEY_KP_SUBTRACT == key && GLFW_PRESS == action)
+        {
+            if (cameraPos < 4000) {
+                cameraPos += 50;
+                camera = glm::vec3(0.0f, 0.0f, cameraPos);
+            }
+        }
+        //Zoom IN
+        if (GLFW_KEY_KP_ADD == key && GLFW_PRESS == action)
+        {
+            if (cameraPos > 3000) {
+                cameraPos -= 50;
+                camera = glm::vec3(0.0f, 0.0f, cameraPos);
+            }
+        }
+
+        // Switch between fixed-step and event-driven (CCD) physics.
+        // CCD is exact at any tick length, so it runs at a much lower tick rate.
+        if (key == GLFW_KEY_C && action == GLFW_PRESS)
+            simulation.Post([]()
+            {
+                // A recording is made at one tick rate: end it before the rate changes
+                if (replayRecorder.IsRecording())
+                    stopReplayRecording();
+
+                useCCD = !useCCD;
+                physicsClock = FixedTimestep(useCCD ? CCD_PHYSICS_HZ : PHYSICS_HZ, PHYSICS_MAX_STEPS);
+                poolBallsCCD.Reset();
+                cout << "\nPhysics mode: " << (useCCD ? "event-driven CCD" : "fixed step") << "\n";
+            });
+
+        // Start/stop recording the match
+        if (key == GLFW_KEY_R && action == GLFW_PRESS)
+            simulation.Post([]()
+            {
+                if (replayRecorder.IsRecording())
+                    stopReplayRecording();
+                else
+                {
+                    // The last recording is still mapped for scrubbing, and we are about to overwrite it
+                    replayReader.Close();
+                    if (replayRecorder.Start("match", physicsClock.TickRate))
+                        cout << "\nRecording to match.replay\n";
+                }
+            });
+
+        // Scrub through the last recording; the table carries on from wherever we land
+        if ((key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT) && action != GLFW_RELEASE)
+            simulation.Post([key]()
+            {
+                if (replayRecorder.IsRecording() || replayReader.LastTick < 0)
+                    return;
+
+                ReplayState state;
+                replayTick += (key == GLFW_KEY_LEFT ? -5 : 5) * (long long)replayReader.TickRate;     // 5 seconds of the recording
+                if (replayTick < replayReader.FirstTick) replayTick = replayReader.FirstTick;
+                if (replayTick > replayReader.LastTick) replayTick = replayReader.LastTick;
+
+                if (replayReader.Seek(replayTick, state))
+                {
+                    state.ApplyTo(poolBalls);
+                    poolBallsCCD.Reset();
+                    cout << "\nReplay tick " << state.Tick << "\n";
+                }
+            });
+
+        // Search for the best shot from the current table and play it. Only a table at rest is
+        // planned for, and one search at a time; the search runs on the planner's pool against a
+        // copy of the table and its result is posted back to the simulation. Headless runs search
+        // synchronously so the shot lands on the same tick every run.
+        if (key == GLFW_KEY_P && action == GLFW_PRESS)
+            simulation.Post([]()
+            {
+                static ShotPlanner planner;
+                if (shotPending)
+                {
+                    cout << "\nStill searching for the last shot\n";
+                    return;
+                }
+                if (poolBalls.Count == 0 || poolBalls.IsPotted(0))
+                {
+                    cout << "\nThe cue ball is in a pocket\n";
+                    return;
+                }
+                if (!poolBalls.AtRest())
+                {
+                    cout << "\nWait for the balls to stop before planning a shot\n";
+                    return;
+                }
+
+                // Search with the physics the table is running, so the shot plays out as planned
+                ShotSearchSettings search;
+                search.TickRate = (float)physicsClock.TickRate;
+                search.UseCCD = useCCD;
+                BallSystem planned = poolBalls;
+                shotPending = true;
+
+                if (headless.Options.Enabled)
+                {
+                    vector<ShotResult> best = planner.Plan(planned, search, 5);
+                    playBestShot(best, planned, search, planner.CandidatesCutOff);
+                    return;
+                }
+
+                bool started = planner.PlanAsync(planned, search, 5, [planned, search](const vector<ShotResult>& best)
+                {
+                    simulation.Post([best, planned, search]()
+                    {
+                        playBestShot(best, planned, search, planner.CandidatesCutOff);
+                    });
+                });
+                if (!started)
+                    shotPending = false;
+            });
+
+        // Frame timings: min/avg/p99 of every profiled scope over the last few seconds
+        if (key == GLFW_KEY_F && action == GLFW_PRESS)
+        {
+            cout << "\n";
+            profiler.PrintSummary(cout);
+        }
+
+        // Start/stop capturing a Chrome trace (open profile.json in chrome://tracing)
+        if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        {
+            if (!profiler.IsCapturing())
+            {
+                profiler.StartCapture();
+                cout << "\nCapturing trace...\n";
+            }
+            else if (profiler.StopCapture("profile.json"))
+                cout << "\nTrace written to profile.json\n";
+        }
+
+        // Edge detection on/off, and its resolution: lower is cheaper, with softer lines
+        if (key == GLFW_KEY_E && action == GLFW_PRESS)
+            postProcess.Enabled = !postProcess.Enabled;
+        if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_PRESS)
+        {
+            postProcess.SetEdgeScale(postProcess.EdgeScale * (key == GLFW_KEY_LEFT_BRACKET ? 0.5f : 2.0f));
+            cout << "\nEdges at " << postProcess.EdgeWidth << "x" << postProcess.EdgeHeight << "\n";
+        }
+
+        // Screen recording: V to a Y4M video, Shift+V to a PNG sequence; again to stop
+        if (key == GLFW_KEY_V && action == GLFW_PRESS)
+        {
+            if (frameCapture.IsRecording())
+            {
+                frameCapture.Stop();
+                cout << "\nRecording stopped: " << frameCapture.FramesWritten << " frames written, "
+                     << frameCapture.FramesDropped << " dropped\n";
+            }
+            else if (modes & GLFW_MOD_SHIFT)
+            {
+                if (frameCapture.Start("capture", FRAME_CAPTURE_PNG, postProcess.Width, postProcess.Height))
+                    cout << "\nRecording to capture_NNNNN.png...\n";
+            }
+            else if (frameCapture.Start("capture.y4m", FRAME_CAPTURE_Y4M, postProcess.Width, postProcess.Height))
+                cout << "\nRecording to capture.y4m...\n";
+        }
+
+        // How much the render queue saved last frame
+        if (key == GLFW_KEY_I && action == GLFW_PRESS)
+        {
+            cout << "\nRender queue: " << renderQueue.Stats.Draws << " draws in "
+                 << renderQueue.Stats.Batches << " calls, "
+                 << renderQueue.Stats.StateChangesIssued << " state changes, "
+                 << renderQueue.Stats.StateChangesSkipped << " redundant ones skipped\n";
+            cout << "Culling: " << sceneCuller.VisibleCount << " visible, " << sceneCuller.CulledCount << " culled\n";
+            cout << "Stream buffer: " << (frameStream.Persistent ? "persistent" : "glBufferSubData") << ", "
+                 << frameStream.Stalls << " stalls, " << frameStream.Overflows << " overflows\n";
+        }
 }
     
 // ============ Call back function for Mouse Drag  ==================
-void clickDragCallback(GLFWwindow* window, int button, int  action, int mode)
+void clickDragCallback(GLFWwindow* window, int button, int  action, int /*mode*/)
     {
         static double startX = 0, startY = 0, endX = 0, endY = 0;
 
@@ -185,7 +524,7 @@ void clickDragCallback(GLFWwindow* window, int button, int  action, int mode)
 // ----------------------------------------------------------------------
 // Whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+void scroll_callback(GLFWwindow* /*window*/, double /*xoffset*/, double /*yoffset*/)
 {
     
     //Zoom out
@@ -199,79 +538,93 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 }
 
 
- //Camera Manipulation
-    // 
-    //Zoom Out
-    if (GLFW_KEY_KP_SUBTRACT == key && GLFW_PRESS == action)
-    {    
-        if (cameraPos < 4000) {
-            cameraPos += 50;
-            camera = glm::vec3(0.0f, 0.0f, cameraPos);
-        }
-    }
-    //Zoom IN
-    if (GLFW_KEY_KP_ADD == key && GLFW_PRESS == action)
-    {
-        if (cameraPos > 3000) {
-            cameraPos -= 50;
-            camera = glm::vec3(0.0f, 0.0f, cameraPos);
-        }
-    }
-
-
 // ================== Section above by: Jonathan Drakes =============
 // ==================================================================
 
 
 
 // The MAIN function, from here we start our application and run our Game loop
-int main()
+int main(int argc, char** argv)
 {
+     // --headless [frames] [--png every] [--size WxH] [--record path] renders with no window (see headless.h)
+     headless.Options = ParseHeadlessOptions(argc, argv);
      init_Resources();
 
-    //-------- PoolBall increments -------------------
-    GLfloat poolBallX = 50.0;
-    GLfloat poolBallY = 10.0;
-    GLfloat poolBallXinc = -0.2;
-    GLfloat poolBallYinc = 0.8;
-    //------------------------------------------------
-
-       //-------- PoolBall2 increments -------------------
-    GLfloat poolBall2X = 10.0;
-    GLfloat poolBall2Y = 50.0;
-    GLfloat poolBall2Xinc = 0.4;
-    GLfloat poolBall2Yinc = -0.7;
+    //-------- Rack the balls (velocities in units per second) -------
+    if (STRESS_BALL_COUNT > 0)
+        SetupStressScene(poolBalls, STRESS_BALL_COUNT);
+    else if (headless.Options.Enabled)
+        SetupRack(poolBalls);           // no keyboard headless, so break straight away
+    else
+        SetupRack(poolBalls, 0.0f);     // at rest until P plans the break
     //------------------------------------------------
 
-    GLdouble xdif, ydif, temp;
-
     
     // ==============================================
     // ====== Set up the stuff for our sphere =======
     // ==============================================
     
-    // 1. Setup and compile our shaders (new approach)
-    Shader poolBallShader("poolBallVertex.glsl", "poolBallFragment.glsl");
- 
-    
-    // 2. Load the earth. mars and venus objects
-    Model poolBall((GLchar*)"10Ball.obj");
-    Model poolBall2((GLchar*)"10Ball.obj");
+    // 1. Load the pool ball object (shared by every ball on the table) into a packed
+    //    arena - half the vertex memory; the ball shaders decode it
+    GeometryArena poolBallArena(true);
+    Model poolBall((GLchar*)"10Ball.obj", false, &poolBallArena);
+    cout << "Pool ball: " << poolBallArena.VertexBytes << " bytes of vertices, " << poolBallArena.IndexBytes
+         << " bytes of " << (poolBallArena.IndexSize == 2 ? "16" : "32") << "-bit indices\n";
+
+
+    // 2. Pack every ball's texture into the layers of one texture array, so the whole rack
+    //    draws with a single texture binding; numbers without their own picture wear the model's
+    TextureArray poolBallTextures;
+    GLint poolBallModelLayer = poolBall.PackTextures(poolBallTextures);
+    vector<GLint> poolBallLayers;           // Layer for each ball number
+    for (int n = 0; n < POOL_BALL_TEXTURES; n++)
+    {
+        GLint layer = poolBallModelLayer >= 0 ? poolBallTextures.Add(to_string(n) + "Ball.png") : -1;
+        poolBallLayers.push_back(layer >= 0 ? layer : max(poolBallModelLayer, 0));
+    }
+    poolBallTextures.Upload();
+    cout << "Pool ball textures: " << poolBallTextures.Layers << " layers of " << poolBallTextures.Width
+         << "x" << poolBallTextures.Height << "\n";
+
+
+    // 3. Compile the ball shader specialised for how the balls are drawn: instanced
+    //    (one draw call per mesh for the whole rack), decoding the arena's positions if packed,
+    //    and reading each ball's layer of the texture array
+    ShaderVariants poolBallShaders("poolBallVertex.glsl", "poolBallFragment.glsl");
+    Shader& poolBallShader = poolBallShaders.Get(SHADER_INSTANCED | (poolBallArena.Packed ? SHADER_PACKED_POSITIONS : 0) |
+                                                 (poolBallModelLayer >= 0 ? SHADER_TEXTURE_ARRAY : 0));
+
+    // Per-ball model matrices, refilled every frame, then split up by level of detail
+    vector<InstanceData> poolBallInstances;
+    vector<InstanceData> poolBallLodInstances;
+    vector<int> poolBallLods;               // LOD each ball was drawn at last frame
     
 
     
  
-    // 3. Set the projection matrix for the camera
+    // 4. Set the projection matrix for the camera
     glm::mat4 projection = glm::perspective(45.0f, (GLfloat)sWidth/(GLfloat)sHeight,
                                             1.0f, 10000.0f);
+
+    // Pixels a unit covers at distance one, for picking levels of detail
+    GLfloat lodPixelsPerUnit = projection[1][1] * sHeight * 0.5f;
     
     
     
-    // 4. Create the projection matrices by Activating the shader objects for each planet
+    // 5. Create the shared camera block; the ball shader reads view/projection from it
 
-    poolBallShader.Use();
-    glUniformMatrix4fv(glGetUniformLocation(poolBallShader.Program, "projection"),
-        1, GL_FALSE, glm::value_ptr(projection));
+    FrameUniforms frameUniforms;
+    frameUniforms.Create();
+
+    // Ring buffer all per-frame data (camera block, ball instances, draw commands) is written to
+    frameStream.Create();
+
+    // Scene targets at the window's framebuffer size (larger than sWidth x sHeight on high-DPI screens)
+    GLint framebufferWidth = sWidth, framebufferHeight = sHeight;
+    if (!headless.Options.Enabled)
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    postProcess.Create(framebufferWidth, framebufferHeight, 1.0f, 10000.0f);
+    postProcess.OutputFBO = headless.Target;
    
     
     
@@ -282,15 +635,20 @@ int main()
     Shader poolStickShader("poolStickVertex.glsl", "poolStickFragment.glsl");
 
     Model poolStick((GLchar*)"10522_Pool_Cue_v1_L3.obj");
+    int poolStickLod = 0;                   // Its level of detail last frame
 
+    // Programs that still declare their own camera uniforms get them set directly
     poolStickShader.Use();
-    glUniformMatrix4fv(glGetUniformLocation(poolStickShader.Program, "projection"),
-        1, GL_FALSE, glm::value_ptr(projection));
+    poolStickShader.Set("projection", projection);
 
 
     /*--////////////////Section above - Done by Zachary Farrell/////////////--*/
    /////////////////////////////////////////////////////////////////////////////
     
+
+    // 6. Resolve the uniforms we update every frame, so the loop never looks them up by name
+    GLint poolStickViewLoc = poolStickShader.Uniform("view");
+    GLint poolStickModelLoc = poolStickShader.Uniform("model");
     
     
         
@@ -299,122 +657,81 @@ int main()
     // ====== Set up the changes we want while the window is open =======
     // ==================================================================
 
-     while(!glfwWindowShouldClose(window))
+    // Start the physics clock only once loading is done, with the rack published for the
+    // first frame; then physics gets its own thread (headless runs step it in the loop, in lockstep)
+    lastPhysicsTime = appTime();
+    simulate(lastPhysicsTime);
+    if (!headless.Options.Enabled)
+        simulation.Start(simulate, appTime);
+    bool firstFrame = true;
+
+    // --record: capture the whole headless run (frames come from the offscreen target)
+    if (headless.Options.Enabled && !headless.Options.RecordPath.empty())
     {
+        string recordPath = headless.Options.RecordPath;
+        if (headless.Options.RecordPng())
+            frameCapture.Start(recordPath.substr(0, recordPath.size() - 4), FRAME_CAPTURE_PNG, postProcess.Width, postProcess.Height);
+        else
+            frameCapture.Start(recordPath, FRAME_CAPTURE_Y4M, postProcess.Width, postProcess.Height);
+    }
+
+     while(headless.Options.Enabled ? !headless.Done() : !glfwWindowShouldClose(window))
+    {
+        PROFILE_SCOPE("Frame");
         
-        // Clear buffers
-        glClearColor(0.0f, 0.345f, 0.141f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Bind and clear the scene targets
+        postProcess.BeginScene(glm::vec4(0.0f, 0.345f, 0.141f, 1.0f));
+
+        // Start writing into the next region of the ring (waits if the GPU is still reading it)
+        frameStream.BeginFrame();
         
         
         // Add transformation matrices ... by repeatedly modifying the model matrix
         
-        // 1. The View matrix for each planet first...
+        // 1. The View matrix, uploaded once for every program through the shared block
 
-        poolBallShader.Use();
-        glUniformMatrix4fv(glGetUniformLocation(poolBallShader.Program, "view"), 1,
-            GL_FALSE, glm::value_ptr(camera.GetViewMatrix()));
+        glm::mat4 view = camera.GetViewMatrix();
+        frameUniforms.Update(view, projection, camera.Position, (GLfloat)appTime());
         
         
-        // 2. Create the model matrix for each planet
-
-       poolBallShader.Use();
-        glm::mat4 poolBallModel = glm::mat4(1);
-        glm::mat4 poolBall2Model = glm::mat4(1);
-       
-        
-
-        // ...Test for PoolBall touching the sides...
-        if (poolBallX > 190 || poolBallX < -190)
-            poolBallXinc *= -1;
-
-        if (poolBallY > 105 || poolBallY < -105)
-            poolBallYinc *= -1;
-
-        // ...Test for PoolBall touching the sides...
-        if (poolBall2X > 190 || poolBall2X < -190)
-            poolBall2Xinc *= -1;
-
-        if (poolBall2Y > 105 || poolBall2Y < -105)
-            poolBall2Yinc *= -1;
-
-
-
-
-
-        // ...Test for balls touching...
-       
-        xdif = poolBallX - poolBall2X;
-        ydif = poolBallY - poolBall2Y;
-        if (sqrt((xdif * xdif) + (ydif * ydif)) < 13) 
+        // 2. Take the newest table the simulation has published, then create the model matrix for each ball
+        if (!simulation.IsRunning())
         {
-            // Once collided, repel and swap speed of translation.
-            temp = poolBallXinc;
-            poolBallXinc = poolBall2Xinc;
-            poolBall2Xinc = temp;
-
-            temp = poolBallYinc;
-            poolBallYinc = poolBall2Yinc;
-            poolBall2Yinc = temp;
+            simulation.RunCommands();
+            simulate(appTime());
         }
+        simulation.Snapshots.Update();
+        const SceneSnapshot& scene = simulation.Snapshots.Read();
 
+        // Draw the balls part-way between the last two ticks so motion stays smooth
+        GLfloat physicsAlpha = scene.Alpha(appTime());
 
+        sceneCuller.Clear();
+        poolBallInstances.resize(scene.Count);
+        for (int i = 0; i < scene.Count; i++)
+        {
+            glm::mat4 poolBallModel = glm::mat4(1);
 
+            // 3. Apply the translation matrix to the ball's model matrix
+            poolBallModel = glm::translate(poolBallModel, glm::vec3(scene.InterpolatedX(i, physicsAlpha),
+                                                                    scene.InterpolatedY(i, physicsAlpha), 0.0f));
 
+            // 4. Apply the scaling matrix to the ball's model matrix
+            GLfloat scale = 6.0f * scene.Radius[i] / BALL_RADIUS;
+            poolBallModel = glm::scale(poolBallModel, glm::vec3(scale, scale, scale));
 
-        //Increment the planets' locationn
-
-        poolBallX += poolBallXinc;
-        poolBallY += poolBallYinc;
-
-        poolBall2X += poolBall2Xinc;
-        poolBall2Y += poolBall2Yinc;
-        
-        
-        
-        
-        // 3. Apply the translation matrix to the planets' model matrix
-        poolBallModel = glm::translate(poolBallModel, glm::vec3(poolBallX, poolBallY, 0.0f));
-        poolBall2Model = glm::translate(poolBall2Model, glm::vec3(poolBall2X, poolBall2Y, 0.0f));
-
-
-
-        // 4. Apply the scaling matrix to the planets' model matrix
-        poolBallModel = glm::scale(poolBallModel, glm::vec3(6.0f, 6.0f, 6.0f));
-        poolBall2Model = glm::scale(poolBall2Model, glm::vec3(6.0f, 6.0f, 6.0f));
-
-
-
-
-        // 5. Apply the rotation matrix to the planets' model matrix
-        poolBallModel = glm::rotate(poolBallModel, -45.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-        poolBall2Model = glm::rotate(poolBall2Model, -45.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-
-
-
-
-        // Make the planets rotate around the y-axis
-       
-        GLfloat poolBallvelocity = sqrt(poolBallXinc * poolBallXinc + poolBallYinc * poolBallYinc);
-        poolBallAngle += poolBallvelocity/12;
-        GLfloat poolBall2velocity = sqrt(poolBall2Xinc * poolBall2Xinc + poolBall2Yinc * poolBall2Yinc);
-        poolBall2Angle += poolBall2velocity / 12;
-        glm::vec3 poolBall1axis = glm::cross(glm::vec3(poolBallXinc, 0.0f, poolBallYinc), glm::vec3(0.0f, 1.0f, 0.0f));
-        poolBallModel = glm::rotate(poolBallModel, poolBallAngle, poolBall1axis);
-        glm::vec3 poolBall2axis = glm::cross(glm::vec3(poolBall2Xinc, 0.0f, poolBall2Yinc), glm::vec3(0.0f, 1.0f, 0.0f));
-        poolBall2Model = glm::rotate(poolBall2Model, poolBall2Angle, poolBall2axis);
-
-
-        glUniformMatrix4fv(glGetUniformLocation(poolBallShader.Program, "model"), 1,
-            GL_FALSE, glm::value_ptr(poolBallModel));
-
-        // Display the poolBall
-        poolBall.Draw(poolBallShader);
+            // 5. Apply the rotation matrix to the ball's model matrix
+            poolBallModel = glm::rotate(poolBallModel, -45.0f, glm::vec3(1.0f, 0.0f, 0.0f));
 
-        glUniformMatrix4fv(glGetUniformLocation(poolBallShader.Program, "model"), 1,
-            GL_FALSE, glm::value_ptr(poolBall2Model));
+            // Make the ball roll about the axis perpendicular to its motion (a resting ball has no axis)
+            glm::vec3 poolBallAxis = glm::cross(glm::vec3(scene.VX[i], 0.0f, scene.VY[i]), glm::vec3(0.0f, 1.0f, 0.0f));
+            if (glm::dot(poolBallAxis, poolBallAxis) > 0.0f)
+                poolBallModel = glm::rotate(poolBallModel, scene.InterpolatedAngle(i, physicsAlpha), poolBallAxis);
 
-        poolBall.Draw(poolBallShader);
+            poolBallInstances[i].Model = poolBallModel;
+            poolBallInstances[i].Layer = (GLfloat)poolBallLayers[i % POOL_BALL_TEXTURES];
+            sceneCuller.Add(TransformSphere(poolBall.Sphere, poolBallModel));     // Cull index i
+        }
 
         
          
@@ -424,8 +741,8 @@ int main()
 
 
         poolStickShader.Use();
-        glUniformMatrix4fv(glGetUniformLocation(poolStickShader.Program, "view"), 1,
-            GL_FALSE, glm::value_ptr(camera.GetViewMatrix()));
+        if (poolStickViewLoc >= 0)
+            poolStickShader.Set(poolStickViewLoc, view);
 
 
 
@@ -433,7 +750,6 @@ int main()
         // =======================================================================
         // Creating the model matrix 
         // =======================================================================
-        poolStickShader.Use();
         glm::mat4 poolStickModel = glm::mat4(1);
 
         //Modify the model matrix with scaling, translation, rotation, etc
@@ -443,37 +759,111 @@ int main()
 
 
         // =======================================================================
-        // Passing the Model matrix, "poolStickModel", to the shader as "model"
+        // Its bounding sphere, so it can be culled along with the balls
         // =======================================================================
-        glUniformMatrix4fv(glGetUniformLocation(poolStickShader.Program, "model"), 1,
-            GL_FALSE, glm::value_ptr(poolStickModel));
+        int poolStickCullIndex = sceneCuller.Add(TransformSphere(poolStick.Sphere, poolStickModel));
 
+         
+        /*--////////////////Section above - Done by Zachary Farrell////////////--*/
+        //////////////////////////////////////////////////////////////////////////
 
 
+        // Cull everything against the camera, then queue only what can be seen
+        {
+            PROFILE_SCOPE("Frustum cull");
+            sceneCuller.Cull(Frustum(projection * view));
+        }
 
-        // =======================================================================
-        // Drawing the Pool Stick object.
-        // =======================================================================
-        poolStick.Draw(poolStickShader);
+        // Visible poolBalls, one instanced draw per level of detail (each keeps its own Layer).
+        // A ball's LOD comes from how big it is on screen, starting from last frame's.
+        poolBallLods.resize(scene.Count, 0);
+        for (int i = 0; i < scene.Count; i++)
+            if (sceneCuller.Visible[i])
+            {
+                BoundingSphere sphere = { glm::vec3(sceneCuller.CenterX[i], sceneCuller.CenterY[i], sceneCuller.CenterZ[i]),
+                                          sceneCuller.Radius[i] };
+                poolBallLods[i] = poolBall.SelectLod(sphere, camera.Position, lodPixelsPerUnit, poolBallLods[i]);
+            }
 
-         
-        /*--////////////////Section above - Done by Zachary Farrell////////////--*/
-        //////////////////////////////////////////////////////////////////////////
+        for (int lod = 0; lod < (int)poolBall.LodErrors.size() || lod == 0; lod++)
+        {
+            poolBallLodInstances.clear();
+            for (int i = 0; i < scene.Count; i++)
+                if (sceneCuller.Visible[i] && poolBallLods[i] == lod)
+                    poolBallLodInstances.push_back(poolBallInstances[i]);
+            poolBall.SubmitInstanced(renderQueue, poolBallShader, poolBallLodInstances, lod);
+        }
+
+        // The Pool Stick; the queue passes "poolStickModel" to the shader as "model" when it draws it
+        if (sceneCuller.Visible[poolStickCullIndex])
+        {
+            BoundingSphere sphere = { glm::vec3(sceneCuller.CenterX[poolStickCullIndex], sceneCuller.CenterY[poolStickCullIndex],
+                                                sceneCuller.CenterZ[poolStickCullIndex]), sceneCuller.Radius[poolStickCullIndex] };
+            poolStickLod = poolStick.SelectLod(sphere, camera.Position, lodPixelsPerUnit, poolStickLod);
+            poolStick.Submit(renderQueue, poolStickShader, poolStickModelLoc, poolStickModel, poolStickLod);
+        }
+
+        // Draw everything queued this frame, sorted to minimise state changes
+        {
+            GPU_PROFILE_SCOPE("Scene");
+            renderQueue.Execute();
+        }
+
+        // Outline the scene and put it on screen
+        postProcess.Apply();
+
+        // Fence this frame's region of the ring behind its draws
+        frameStream.EndFrame();
          
         
         
             
          
-        // Swap the frame buffers
-        glfwSwapBuffers(window);
+        // Queue this frame's readback if recording (never waits on the GPU)
+        frameCapture.Capture(headless.Target);
+
+        // Swap the frame buffers (headless: finish, time and maybe save the frame)
+        if (headless.Options.Enabled)
+            headless.EndFrame();
+        else
+        {
+            PROFILE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
+
+        // Startup cost, warm (programs from the binary cache) vs cold
+        if (firstFrame)
+        {
+            firstFrame = false;
+            cout << "First frame after " << (headless.Options.Enabled ? headless.Elapsed() : glfwGetTime()) << "s (" << programCache.Hits << " programs from the cache, "
+                 << programCache.Misses << " compiled)\n";
+        }
         
-        glfwPollEvents();
+        if (!headless.Options.Enabled)
+            glfwPollEvents();
+
+        // Gather this frame's timings (F prints the summary, T captures a trace)
+        gpuProfiler.EndFrame();
+        profiler.EndFrame();
         
      
 
     }
     
-    glfwTerminate();
+    // Stop the physics, then finish any recording while the context is still alive
+    simulation.Stop();
+    frameCapture.Stop();
+
+    if (headless.Options.Enabled)
+        {
+            headless.Report.Print(cout);
+            if (!headless.Options.RecordPath.empty())
+                cout << "Recorded " << frameCapture.FramesWritten << " frames to " << headless.Options.RecordPath << ", "
+                     << frameCapture.FramesDropped << " dropped\n";
+            headless.Destroy();
+        }
+    else
+        glfwTerminate();
     return 0;
 }
 
@@ -0,0 +1,438 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include "spatialgrid.h"
+
+// SIMD Includes - SSE2 is always there on x64, AVX is used when the compiler is told to (/arch:AVX)
+#include <immintrin.h>
+
+
+// ====================================================================
+//  BallSystem - every pool ball on the table, stored as a structure of
+//  arrays (one array per field) instead of one struct per ball.
+//
+//  Keeping X, Y, VX, ... in their own contiguous arrays lets the
+//  integration and rail kernels below load 4 (SSE) or 8 (AVX) balls at
+//  a time. The arrays are padded up to a multiple of SIMD_WIDTH with
+//  parked, motionless balls so the kernels never need a scalar tail.
+//
+//  The table has six pockets, at the corners of the rails and the
+//  middle of each long one. A ball whose centre gets within
+//  POCKET_RADIUS of one is potted: it is parked far off the table,
+//  where it can't touch anything, and listed in Potted for that tick.
+// ====================================================================
+
+
+// Default table values (ball centres bounce off these rails)
+const float TABLE_MIN_X     = -190.0f;
+const float TABLE_MAX_X     =  190.0f;
+const float TABLE_MIN_Y     = -105.0f;
+const float TABLE_MAX_Y     =  105.0f;
+const float BALL_RADIUS     =  6.5f;        // Two balls touch when their centres are 13 apart
+const float BALL_ROLL_SCALE =  12.0f;       // Distance travelled per radian of rolling
+const int   GRID_MIN_BALLS  =  48;          // Below this, testing every pair beats walking the grid
+const int   POCKET_COUNT    =  6;
+const float POCKET_RADIUS   =  12.0f;       // A ball centre this close to a pocket drops in
+const float POCKET_PARK_X   =  1.0e6f;      // Potted balls wait out here, 100 apart
+
+#if defined(__AVX__)
+const int SIMD_WIDTH = 8;
+#else
+const int SIMD_WIDTH = 4;
+#endif
+
+
+class BallSystem
+    {
+        public:
+            //  Ball Data (one entry per ball, padded to a multiple of SIMD_WIDTH)
+            vector<float> X, Y;             // Position on the table
+            vector<float> VX, VY;           // Velocity in units per second
+            vector<float> Angle;            // Accumulated rolling angle
+            vector<float> Radius;
+            vector<float> PrevX, PrevY;     // State at the previous tick (for interpolation)
+            vector<float> PrevAngle;
+            int Count;                      // Number of real balls
+            float MaxRadius;                // Largest radius (sets the grid cell size)
+
+            // Table rails
+            float MinX, MaxX, MinY, MaxY;
+
+            // Collision broad phase
+            SpatialGrid Grid;
+            vector<BallPair> CandidatePairs;
+            vector<BallPair> Contacts;      // Pairs that collided in the last CollideBalls()
+            int ContactCount;
+            int GridMinBalls;               // Use the grid only from this many balls up
+
+            // Follow (> 0) or draw (< 0) from the last Strike, put on the cue ball (ball 0)
+            // when it first hits another ball, along the direction it was struck in
+            float PendingSpin, SpinDirX, SpinDirY;
+
+            // Pockets
+            bool Pockets;                   // Whether balls can be potted at all
+            vector<int> Potted;             // Balls potted in the last tick
+
+            BallSystem() : Count(0), MaxRadius(0.0f), MinX(TABLE_MIN_X), MaxX(TABLE_MAX_X), MinY(TABLE_MIN_Y),
+                           MaxY(TABLE_MAX_Y), ContactCount(0), GridMinBalls(GRID_MIN_BALLS),
+                           PendingSpin(0.0f), SpinDirX(0.0f), SpinDirY(0.0f), Pockets(true)
+                {
+                }
+
+            // Adds a ball and returns its index
+            int AddBall(float x, float y, float vx, float vy, float radius = BALL_RADIUS)
+                {
+                    int i = this->Count++;
+                    this->resize(this->Count);
+
+                    this->X[i] = this->PrevX[i] = x;
+                    this->Y[i] = this->PrevY[i] = y;
+                    this->VX[i] = vx;
+                    this->VY[i] = vy;
+                    this->Angle[i] = this->PrevAngle[i] = 0.0f;
+                    this->Radius[i] = radius;
+                    if (radius > this->MaxRadius)
+                        this->MaxRadius = radius;
+                    return i;
+                }
+
+            // Removes every ball (keeps the memory for reuse)
+            void Clear()
+                {
+                    this->Count = 0;
+                    this->MaxRadius = 0.0f;
+                    this->PendingSpin = 0.0f;
+                    this->Potted.clear();
+                    this->resize(0);
+                }
+
+            // Plays a cue shot: the cue ball heads off at `angle` (radians) with speed `power`,
+            // and `spin` is a fraction of its speed added or taken away at first contact
+            void Strike(float angle, float power, float spin = 0.0f)
+                {
+                    if (this->Count == 0)
+                        return;
+                    this->SpinDirX = cos(angle);
+                    this->SpinDirY = sin(angle);
+                    this->VX[0] = power * this->SpinDirX;
+                    this->VY[0] = power * this->SpinDirY;
+                    this->PendingSpin = spin;
+                }
+
+            // Call after a collision with the cue ball's velocity from before it. Returns whether
+            // the cue ball hit something; the first time it does, the spin from Strike goes on.
+            bool CueContact(float cueVX, float cueVY)
+                {
+                    if (this->Count == 0 || (this->VX[0] == cueVX && this->VY[0] == cueVY))
+                        return false;
+                    if (this->PendingSpin != 0.0f)
+                        {
+                            float speed = sqrt(cueVX * cueVX + cueVY * cueVY);
+                            this->VX[0] += this->PendingSpin * speed * this->SpinDirX;
+                            this->VY[0] += this->PendingSpin * speed * this->SpinDirY;
+                            this->PendingSpin = 0.0f;
+                        }
+                    return true;
+                }
+
+            // Pocket p: 0-2 along the bottom rail from the left, 3-5 along the top
+            float PocketX(int p) const { return p % 3 == 0 ? this->MinX : p % 3 == 1 ? 0.5f * (this->MinX + this->MaxX) : this->MaxX; }
+            float PocketY(int p) const { return p < 3 ? this->MinY : this->MaxY; }
+
+            // Index of the pocket a ball centre at (x, y) has dropped into, or -1
+            int PocketAt(float x, float y) const
+                {
+                    for (int p = 0; p < POCKET_COUNT; p++)
+                        {
+                            float dx = x - this->PocketX(p), dy = y - this->PocketY(p);
+                            if (dx * dx + dy * dy < POCKET_RADIUS * POCKET_RADIUS)
+                                return p;
+                        }
+                    return -1;
+                }
+
+            bool IsPotted(int i) const { return this->X[i] >= 0.5f * POCKET_PARK_X; }
+
+            // Whether nothing on the table is moving (potted balls are parked still)
+            bool AtRest() const
+                {
+                    for (int i = 0; i < this->Count; i++)
+                        if (this->VX[i] != 0.0f || this->VY[i] != 0.0f)
+                            return false;
+                    return true;
+                }
+
+            // Parks every ball that has reached a pocket off the table and lists it in Potted.
+            // Returns how many went down.
+            int PocketBalls()
+                {
+                    this->Potted.clear();
+                    if (!this->Pockets)
+                        return 0;
+                    for (int b = 0; b < this->Count; b++)
+                        {
+                            if (this->IsPotted(b) || this->PocketAt(this->X[b], this->Y[b]) < 0)
+                                continue;
+                            this->X[b] = this->PrevX[b] = POCKET_PARK_X + 100.0f * b;
+                            this->Y[b] = this->PrevY[b] = 0.0f;
+                            this->VX[b] = this->VY[b] = 0.0f;
+                            this->Potted.push_back(b);
+                        }
+                    return (int)this->Potted.size();
+                }
+
+            // Remembers the current state as the previous one, before a tick changes it
+            void SavePrevious()
+                {
+                    size_t bytes = this->X.size() * sizeof(float);
+                    if (bytes == 0)
+                        return;
+                    memcpy(&this->PrevX[0], &this->X[0], bytes);
+                    memcpy(&this->PrevY[0], &this->Y[0], bytes);
+                    memcpy(&this->PrevAngle[0], &this->Angle[0], bytes);
+                }
+
+            void ReflectRails();            // Bounces balls off the table rails
+            void CollideBalls();            // Exchanges velocities of touching balls (grid broad phase)
+            void CollideBallsBruteForce();  // Same result, testing every pair (small tables)
+            void Integrate(float dt);       // Moves and rolls every ball by dt seconds
+
+            // Runs one full physics tick of dt seconds
+            void Step(float dt)
+                {
+                    this->SavePrevious();
+                    this->ReflectRails();
+                    float cueVX = this->VX.empty() ? 0.0f : this->VX[0];
+                    float cueVY = this->VY.empty() ? 0.0f : this->VY[0];
+                    this->CollideBalls();
+                    if (this->PendingSpin != 0.0f)
+                        this->CueContact(cueVX, cueVY);
+                    this->Integrate(dt);
+                    this->PocketBalls();
+                }
+
+            // Blended state for drawing; alpha = 0 gives the previous tick, 1 the current one
+            float InterpolatedX(int i, float alpha) const { return this->PrevX[i] + (this->X[i] - this->PrevX[i]) * alpha; }
+            float InterpolatedY(int i, float alpha) const { return this->PrevY[i] + (this->Y[i] - this->PrevY[i]) * alpha; }
+            float InterpolatedAngle(int i, float alpha) const { return this->PrevAngle[i] + (this->Angle[i] - this->PrevAngle[i]) * alpha; }
+
+        private:
+            // Narrow phase: swaps the velocities of two balls if they touch and are approaching
+            bool resolvePair(int i, int j)
+                {
+                    float dx = this->X[i] - this->X[j];
+                    float dy = this->Y[i] - this->Y[j];
+                    float r = this->Radius[i] + this->Radius[j];
+                    if (dx * dx + dy * dy >= r * r)
+                        return false;
+
+                    float approach = dx * (this->VX[i] - this->VX[j]) + dy * (this->VY[i] - this->VY[j]);
+                    if (approach >= 0.0f)
+                        return false;
+
+                    // Once collided, repel and swap speed of translation.
+                    float temp = this->VX[i]; this->VX[i] = this->VX[j]; this->VX[j] = temp;
+                    temp = this->VY[i]; this->VY[i] = this->VY[j]; this->VY[j] = temp;
+                    return true;
+                }
+
+            // Grows/shrinks every array to hold n balls, rounded up to whole SIMD lanes
+            void resize(int n)
+                {
+                    size_t padded = (size_t)((n + SIMD_WIDTH - 1) / SIMD_WIDTH) * SIMD_WIDTH;
+                    vector<float>* fields[] = { &X, &Y, &VX, &VY, &Angle, &Radius, &PrevX, &PrevY, &PrevAngle };
+                    for (int f = 0; f < 9; f++)
+                        fields[f]->resize(padded, 0.0f);
+                }
+    };
+
+
+
+// Reflects balls that have reached a rail so they head back onto the table.
+// The velocity is forced to point inward (rather than just negated) so a ball
+// that is still past the rail on the next tick can't flip back outward.
+void BallSystem::ReflectRails()
+    {
+        int n = (int)this->X.size();
+#if defined(__AVX__)
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        const __m256 minX = _mm256_set1_ps(this->MinX), maxX = _mm256_set1_ps(this->MaxX);
+        const __m256 minY = _mm256_set1_ps(this->MinY), maxY = _mm256_set1_ps(this->MaxY);
+        for (int i = 0; i < n; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(&this->X[i]),  y = _mm256_loadu_ps(&this->Y[i]);
+                __m256 vx = _mm256_loadu_ps(&this->VX[i]), vy = _mm256_loadu_ps(&this->VY[i]);
+                __m256 absVx = _mm256_andnot_ps(signMask, vx), absVy = _mm256_andnot_ps(signMask, vy);
+
+                // Past the high rail: -|v|, past the low rail: +|v|, otherwise unchanged
+                vx = _mm256_blendv_ps(vx, _mm256_or_ps(absVx, signMask), _mm256_cmp_ps(x, maxX, _CMP_GT_OQ));
+                vx = _mm256_blendv_ps(vx, absVx, _mm256_cmp_ps(x, minX, _CMP_LT_OQ));
+                vy = _mm256_blendv_ps(vy, _mm256_or_ps(absVy, signMask), _mm256_cmp_ps(y, maxY, _CMP_GT_OQ));
+                vy = _mm256_blendv_ps(vy, absVy, _mm256_cmp_ps(y, minY, _CMP_LT_OQ));
+
+                _mm256_storeu_ps(&this->VX[i], vx);
+                _mm256_storeu_ps(&this->VY[i], vy);
+            }
+#else
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 minX = _mm_set1_ps(this->MinX), maxX = _mm_set1_ps(this->MaxX);
+        const __m128 minY = _mm_set1_ps(this->MinY), maxY = _mm_set1_ps(this->MaxY);
+        for (int i = 0; i < n; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(&this->X[i]),  y = _mm_loadu_ps(&this->Y[i]);
+                __m128 vx = _mm_loadu_ps(&this->VX[i]), vy = _mm_loadu_ps(&this->VY[i]);
+                __m128 absVx = _mm_andnot_ps(signMask, vx), absVy = _mm_andnot_ps(signMask, vy);
+
+                // SSE2 has no blend, so select with and/andnot/or
+                __m128 hi = _mm_cmpgt_ps(x, maxX), lo = _mm_cmplt_ps(x, minX);
+                vx = _mm_or_ps(_mm_andnot_ps(_mm_or_ps(hi, lo), vx),
+                     _mm_or_ps(_mm_and_ps(hi, _mm_or_ps(absVx, signMask)), _mm_and_ps(lo, absVx)));
+                hi = _mm_cmpgt_ps(y, maxY);
+                lo = _mm_cmplt_ps(y, minY);
+                vy = _mm_or_ps(_mm_andnot_ps(_mm_or_ps(hi, lo), vy),
+                     _mm_or_ps(_mm_and_ps(hi, _mm_or_ps(absVy, signMask)), _mm_and_ps(lo, absVy)));
+
+                _mm_storeu_ps(&this->VX[i], vx);
+                _mm_storeu_ps(&this->VY[i], vy);
+            }
+#endif
+    }
+
+
+
+// Swaps the velocities of touching balls. For larger scenes the spatial
+// grid narrows the candidates down to balls in neighbouring cells, then
+// each candidate is checked with a squared-distance test (no sqrt). A pair is only swapped
+// while the balls are still approaching, so a pair that stays overlapped
+// for a few ticks does not keep swapping back and forth.
+void BallSystem::CollideBalls()
+    {
+        // Nothing to collide (and no X[0] to hand the grid)
+        if (this->Count < 2)
+            {
+                this->Contacts.clear();
+                this->ContactCount = 0;
+                return;
+            }
+
+        // A full rack is cheaper to test pair by pair than to walk every cell of the table
+        if (this->Count < this->GridMinBalls)
+            {
+                this->CollideBallsBruteForce();
+                return;
+            }
+
+        this->Contacts.clear();
+
+        this->Grid.Update(&this->X[0], &this->Y[0], this->Count,
+                          this->MinX, this->MinY, this->MaxX, this->MaxY, 2.0f * this->MaxRadius);
+        this->Grid.FindCandidatePairs(this->CandidatePairs);
+
+        for (size_t p = 0; p < this->CandidatePairs.size(); p++)
+            if (this->resolvePair(this->CandidatePairs[p].A, this->CandidatePairs[p].B))
+                this->Contacts.push_back(this->CandidatePairs[p]);
+        this->ContactCount = (int)this->Contacts.size();
+    }
+
+
+
+// Tests every pair of balls - O(N^2). CollideBalls uses it below GridMinBalls, where
+// it beats the grid; it is also what the grid is checked and benchmarked against
+void BallSystem::CollideBallsBruteForce()
+    {
+        this->Contacts.clear();
+        for (int i = 0; i < this->Count; i++)
+            for (int j = i + 1; j < this->Count; j++)
+                if (this->resolvePair(i, j))
+                    this->Contacts.push_back(BallPair{ i, j });
+        this->ContactCount = (int)this->Contacts.size();
+    }
+
+
+
+// Moves every ball along its velocity and rolls it by the distance travelled
+void BallSystem::Integrate(float dt)
+    {
+        int n = (int)this->X.size();
+#if defined(__AVX__)
+        const __m256 step = _mm256_set1_ps(dt);
+        const __m256 roll = _mm256_set1_ps(dt / BALL_ROLL_SCALE);
+        for (int i = 0; i < n; i += 8)
+            {
+                __m256 vx = _mm256_loadu_ps(&this->VX[i]), vy = _mm256_loadu_ps(&this->VY[i]);
+                _mm256_storeu_ps(&this->X[i], _mm256_add_ps(_mm256_loadu_ps(&this->X[i]), _mm256_mul_ps(vx, step)));
+                _mm256_storeu_ps(&this->Y[i], _mm256_add_ps(_mm256_loadu_ps(&this->Y[i]), _mm256_mul_ps(vy, step)));
+
+                __m256 speed = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)));
+                _mm256_storeu_ps(&this->Angle[i], _mm256_add_ps(_mm256_loadu_ps(&this->Angle[i]), _mm256_mul_ps(speed, roll)));
+            }
+#else
+        const __m128 step = _mm_set1_ps(dt);
+        const __m128 roll = _mm_set1_ps(dt / BALL_ROLL_SCALE);
+        for (int i = 0; i < n; i += 4)
+            {
+                __m128 vx = _mm_loadu_ps(&this->VX[i]), vy = _mm_loadu_ps(&this->VY[i]);
+                _mm_storeu_ps(&this->X[i], _mm_add_ps(_mm_loadu_ps(&this->X[i]), _mm_mul_ps(vx, step)));
+                _mm_storeu_ps(&this->Y[i], _mm_add_ps(_mm_loadu_ps(&this->Y[i]), _mm_mul_ps(vy, step)));
+
+                __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)));
+                _mm_storeu_ps(&this->Angle[i], _mm_add_ps(_mm_loadu_ps(&this->Angle[i]), _mm_mul_ps(speed, roll)));
+            }
+#endif
+    }
+
+
+
+
+// ====================================================================
+//  Scene set-up helpers
+// ====================================================================
+
+// A standard 15-ball triangle rack plus a cue ball heading into it
+void SetupRack(BallSystem& balls, float cueSpeed = 150.0f)
+    {
+        balls.Clear();
+        balls.Pockets = true;
+
+        // Cue ball first, so index 0 is always the cue ball
+        balls.AddBall(-100.0f, 0.0f, cueSpeed, 0.0f);
+
+        // Rows of 1, 2, 3, 4, 5 balls, apex pointing at the cue ball
+        const float spacing = 2.0f * BALL_RADIUS + 0.01f;
+        const float rowStep = spacing * 0.8660254f;     // sqrt(3)/2: rows of touching balls
+        for (int row = 0; row < 5; row++)
+            for (int k = 0; k <= row; k++)
+                balls.AddBall(80.0f + row * rowStep, (k - row * 0.5f) * spacing, 0.0f, 0.0f);
+    }
+
+
+// Lots of balls scattered over a grid with random velocities - for stress testing
+void SetupStressScene(BallSystem& balls, int count, float maxSpeed = 60.0f, unsigned int seed = 1)
+    {
+        balls.Clear();
+        balls.Pockets = false;          // Keep every ball in play
+        srand(seed);
+
+        // Spread the balls out on a grid so that none start overlapped
+        int perRow = (int)ceil(sqrt((double)count * (balls.MaxX - balls.MinX) / (balls.MaxY - balls.MinY)));
+        if (perRow < 1)
+            perRow = 1;
+        int rows = (count + perRow - 1) / perRow;
+        float gapX = (balls.MaxX - balls.MinX) / perRow;
+        float gapY = (balls.MaxY - balls.MinY) / (rows > 0 ? rows : 1);
+        float radius = fminf(BALL_RADIUS, 0.45f * fminf(gapX, gapY));
+
+        for (int i = 0; i < count; i++)
+            {
+                float x = balls.MinX + (i % perRow + 0.5f) * gapX;
+                float y = balls.MinY + (i / perRow + 0.5f) * gapY;
+                float vx = maxSpeed * (2.0f * rand() / RAND_MAX - 1.0f);
+                float vy = maxSpeed * (2.0f * rand() / RAND_MAX - 1.0f);
+                balls.AddBall(x, y, vx, vy, radius);
+            }
+    }
@@ -0,0 +1,102 @@
+//
+//  benchmark_broadphase.cpp
+//
+//  Measures how the ball-ball collision pass scales with the number of
+//  balls, comparing the spatial grid broad phase against testing every
+//  pair. The table is grown with the ball count so the density (and so
+//  the number of real contacts per ball) stays the same at every size.
+//
+//  This is a separate console program with its own main(), so it is not
+//  part of GroupProject.vcxproj. It needs no OpenGL. Build it with e.g.
+//
+//      cl /O2 /EHsc benchmark_broadphase.cpp
+//      g++ -O2 -std=c++11 benchmark_broadphase.cpp -o benchmark_broadphase
+//
+// ========================================================================
+
+#include <cstdio>
+#include <chrono>
+
+#include "ballsystem.h"
+
+
+// Area of table per ball; roughly a loose rack
+const float AREA_PER_BALL = 400.0f;
+
+// Brute force is O(N^2), so stop timing it past this many balls
+const int BRUTE_FORCE_LIMIT = 10000;
+
+
+// Seconds spent running the collision pass `ticks` times
+double timeCollisions(BallSystem& balls, int ticks, bool useGrid, long long& pairsTested)
+    {
+        pairsTested = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int t = 0; t < ticks; t++)
+            {
+                balls.ReflectRails();
+                if (useGrid)
+                    {
+                        balls.CollideBalls();
+                        pairsTested += (long long)balls.CandidatePairs.size();
+                    }
+                else
+                    {
+                        balls.CollideBallsBruteForce();
+                        pairsTested += (long long)balls.Count * (balls.Count - 1) / 2;
+                    }
+                balls.Integrate(1.0f / 120.0f);
+            }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+
+int main()
+{
+    const int sizes[] = { 16, 100, 1000, 10000, 100000 };
+
+    printf("%8s | %-32s | %-32s\n", "", "grid broad phase", "brute force");
+    printf("%8s | %10s %10s %10s | %10s %10s %10s\n",
+           "balls", "ms/tick", "Mpairs/s", "pairs/ball", "ms/tick", "Mpairs/s", "speedup");
+
+    for (int s = 0; s < 5; s++)
+        {
+            int n = sizes[s];
+
+            // Keep the table's aspect ratio, scaled so every ball gets AREA_PER_BALL
+            float scale = sqrtf(n * AREA_PER_BALL / ((TABLE_MAX_X - TABLE_MIN_X) * (TABLE_MAX_Y - TABLE_MIN_Y)));
+            BallSystem balls;
+            balls.MinX = TABLE_MIN_X * scale;  balls.MaxX = TABLE_MAX_X * scale;
+            balls.MinY = TABLE_MIN_Y * scale;  balls.MaxY = TABLE_MAX_Y * scale;
+            SetupStressScene(balls, n);
+            balls.GridMinBalls = 0;             // Always time the grid, even for tiny scenes
+
+            // Run about the same number of ball-ticks at every size
+            int ticks = 2000000 / n;
+            if (ticks < 20)
+                ticks = 20;
+
+            // Warm up so the grid's cell lists have their final capacity
+            long long pairs;
+            timeCollisions(balls, 10, true, pairs);
+            double gridTime = timeCollisions(balls, ticks, true, pairs);
+            double gridPairs = (double)pairs;
+
+            printf("%8d | %10.4f %10.2f %10.2f |", n, 1000.0 * gridTime / ticks,
+                   gridPairs / gridTime / 1e6, gridPairs / ticks / n);
+
+            if (n <= BRUTE_FORCE_LIMIT)
+                {
+                    BallSystem bruteBalls = balls;
+                    int bruteTicks = ticks > 200 ? 200 : ticks;
+                    double bruteTime = timeCollisions(bruteBalls, bruteTicks, false, pairs);
+                    printf(" %10.4f %10.2f %9.1fx\n", 1000.0 * bruteTime / bruteTicks,
+                           (double)pairs / bruteTime / 1e6, (bruteTime / bruteTicks) / (gridTime / ticks));
+                }
+            else
+                printf(" %10s %10s %10s\n", "-", "-", "-");
+        }
+
+    return 0;
+}
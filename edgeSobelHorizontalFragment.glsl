@@ -0,0 +1,33 @@
+#version 330 core
+// First half of the separable Sobel (see postprocess.h). Per edge-target texel
+// the signal is (log depth, normal.xyz); this pass writes its horizontal
+// difference [-1 0 1] and horizontal smoothing [1 2 1] for the vertical pass.
+in vec2 TexCoords;
+
+layout (location = 0) out vec4 difference;
+layout (location = 1) out vec4 smoothed;
+
+uniform sampler2D sceneDepth;
+uniform sampler2D sceneNormal;
+uniform vec2 texelSize;             // One edge-target texel, in UV
+uniform vec2 depthRange;            // Camera near, far
+uniform float depthWeight;
+uniform float normalWeight;
+
+vec4 signal(vec2 uv)
+{
+    float z = texture(sceneDepth, uv).r * 2.0f - 1.0f;
+    float linearDepth = 2.0f * depthRange.x * depthRange.y / (depthRange.y + depthRange.x - z * (depthRange.y - depthRange.x));
+    vec3 normal = texture(sceneNormal, uv).xyz * 2.0f - 1.0f;
+    return vec4(log2(linearDepth) * depthWeight, normal * normalWeight);
+}
+
+void main()
+{
+    vec4 left = signal(TexCoords - vec2(texelSize.x, 0.0f));
+    vec4 centre = signal(TexCoords);
+    vec4 right = signal(TexCoords + vec2(texelSize.x, 0.0f));
+
+    difference = right - left;
+    smoothed = left + 2.0f * centre + right;
+}
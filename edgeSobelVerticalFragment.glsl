@@ -0,0 +1,24 @@
+#version 330 core
+// Second half of the separable Sobel (see postprocess.h): smooths the horizontal
+// differences [1 2 1] and differences the horizontal smoothing [-1 0 1]
+// vertically, giving Gx and Gy for depth and normal, and thresholds the larger.
+in vec2 TexCoords;
+
+out float edge;
+
+uniform sampler2D horizontalDifference;
+uniform sampler2D horizontalSmoothed;
+uniform vec2 texelSize;
+uniform float threshold;
+
+void main()
+{
+    vec2 up = vec2(0.0f, texelSize.y);
+    vec4 gx = texture(horizontalDifference, TexCoords - up) + 2.0f * texture(horizontalDifference, TexCoords)
+            + texture(horizontalDifference, TexCoords + up);
+    vec4 gy = texture(horizontalSmoothed, TexCoords + up) - texture(horizontalSmoothed, TexCoords - up);
+
+    float depthEdge = length(vec2(gx.x, gy.x));
+    float normalEdge = sqrt(dot(gx.yzw, gx.yzw) + dot(gy.yzw, gy.yzw));
+    edge = smoothstep(threshold, threshold * 2.0f, max(depthEdge, normalEdge));
+}
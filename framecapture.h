@@ -0,0 +1,345 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "replay.h"         // SpscByteRing
+#include "imagewriter.h"
+#include "profiler.h"
+
+
+// ====================================================================
+//  Frame capture - records what is on screen to a Y4M video stream or
+//  a PNG sequence without stalling the render loop.
+//
+//  Capture() goes right before the buffer swap. It starts an
+//  asynchronous glReadPixels into one of FRAME_CAPTURE_PBOS pixel-pack
+//  buffers and fences it; a frame or two later, once the fence has
+//  passed, the pixels are copied out of the mapped buffer into a
+//  lock-free ring and a writer thread converts and writes them. The
+//  render thread never waits: if every buffer is still in flight, or
+//  the writer has fallen behind and the ring is full, the frame is
+//  dropped and counted instead. Y4M has no timestamps, so the writer
+//  repeats the frame before a drop in its place and the video still
+//  plays at FRAME_CAPTURE_FPS; PNGs keep their frame numbers, gaps and
+//  all.
+//
+//  Y4M is raw 4:2:0 YUV (BT.601, full range) that ffmpeg and most
+//  players read directly, e.g.
+//      ffmpeg -i capture.y4m -c:v libx264 capture.mp4
+// ====================================================================
+
+
+const int    FRAME_CAPTURE_PBOS         = 3;            // Readbacks in flight
+const size_t FRAME_CAPTURE_RING_BYTES   = 1 << 25;      // 32 MB: about 9 frames at 1280x720
+const int    FRAME_CAPTURE_FPS          = 60;           // Written into the Y4M header
+
+
+enum FrameCaptureFormat
+    {
+        FRAME_CAPTURE_Y4M,          // One .y4m stream
+        FRAME_CAPTURE_PNG           // <name>_NNNNN.png per frame
+    };
+
+
+struct FrameCaptureHeader
+    {
+        int64_t Frame;
+        int32_t Width;
+        int32_t Height;
+    };
+
+
+class FrameCapture
+    {
+        public:
+            // Stats
+            long long FramesCaptured;           // Handed to the writer
+            atomic<long long> FramesWritten;
+            long long FramesDropped;            // Readbacks or ring full
+            long long FramesRepeated;           // Y4M frames written again in place of dropped ones
+
+            FrameCapture() : FramesCaptured(0), FramesWritten(0), FramesDropped(0), FramesRepeated(0), ring(FRAME_CAPTURE_RING_BYTES),
+                             running(false), format(FRAME_CAPTURE_Y4M), file(nullptr), width(0), height(0), frame(0), next(0),
+                             lastWritten(-1)
+                {
+                    for (int i = 0; i < FRAME_CAPTURE_PBOS; i++)
+                        {
+                            this->slots[i].Buffer = 0;
+                            this->slots[i].Fence = 0;
+                        }
+                }
+
+            ~FrameCapture() { this->Stop(); }
+
+            // Starts recording `width` x `height` frames to `path` (a .y4m file, or the
+            // prefix of the PNGs); needs a GL context
+            bool Start(const string& path, FrameCaptureFormat format, GLint width, GLint height)
+                {
+                    this->Stop();
+                    this->format = format;
+                    this->path = path;
+                    this->width = width;
+                    this->height = height;
+
+                    if (format == FRAME_CAPTURE_Y4M)
+                        {
+                            this->file = fopen(path.c_str(), "wb");
+                            if (!this->file)
+                                {
+                                    cout << "ERROR::CAPTURE:: could not create " << path << endl;
+                                    return false;
+                                }
+                            fprintf(this->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, FRAME_CAPTURE_FPS);
+                        }
+
+                    GLsizeiptr bytes = (GLsizeiptr)width * height * 4;
+                    for (int i = 0; i < FRAME_CAPTURE_PBOS; i++)
+                        {
+                            glGenBuffers(1, &this->slots[i].Buffer);
+                            glBindBuffer(GL_PIXEL_PACK_BUFFER, this->slots[i].Buffer);
+                            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+                            this->slots[i].Fence = 0;
+                        }
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+                    this->FramesCaptured = 0;
+                    this->FramesWritten = 0;
+                    this->FramesDropped = 0;
+                    this->FramesRepeated = 0;
+                    this->frame = 0;
+                    this->next = 0;
+                    this->lastWritten = -1;
+                    this->yuv.clear();
+                    this->running = true;
+                    this->writer = thread(&FrameCapture::writerLoop, this);
+                    return true;
+                }
+
+            // Collects the readbacks still in flight, lets the writer finish, and closes the file
+            void Stop()
+                {
+                    if (!this->running)
+                        return;
+                    this->collect(true);
+                    for (int i = 0; i < FRAME_CAPTURE_PBOS; i++)
+                        glDeleteBuffers(1, &this->slots[i].Buffer);
+
+                    this->running = false;
+                    this->writer.join();
+                    if (this->file)
+                        {
+                            this->repeatLast(this->frame);      // Frames dropped after the last one written
+                            fclose(this->file);
+                        }
+                    this->file = nullptr;
+                }
+
+            bool IsRecording() const { return this->running; }
+
+            // Call right before swapping: queues a readback of `framebuffer` (0 for the
+            // window's back buffer) and hands finished ones to the writer. Never blocks.
+            void Capture(GLuint framebuffer)
+                {
+                    if (!this->running)
+                        return;
+                    PROFILE_SCOPE("FrameCapture::Capture");
+
+                    this->collect(false);
+
+                    CaptureSlot& slot = this->slots[this->next];
+                    if (slot.Fence)
+                        {
+                            this->FramesDropped++;          // The GPU is FRAME_CAPTURE_PBOS frames behind
+                            this->frame++;
+                            return;
+                        }
+
+                    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+                    glReadBuffer(framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+                    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+                    glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);     // Into the buffer, asynchronously
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+                    slot.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    slot.Frame = this->frame++;
+                    this->next = (this->next + 1) % FRAME_CAPTURE_PBOS;
+                }
+
+        private:
+            struct CaptureSlot
+                {
+                    GLuint Buffer;
+                    GLsync Fence;           // Set while a readback is in flight
+                    long long Frame;
+                };
+
+            SpscByteRing ring;
+            atomic<bool> running;
+            thread writer;
+            FrameCaptureFormat format;
+            string path;
+            FILE* file;
+            GLint width, height;
+            long long frame;
+            int next;                       // Slot the next readback goes into
+            CaptureSlot slots[FRAME_CAPTURE_PBOS];
+
+            // Writer thread state
+            vector<uint8_t> pixels;
+            vector<uint8_t> yuv;            // Last Y4M frame written
+            long long lastWritten;          // Its frame number
+
+            // Moves finished readbacks, oldest first, into the ring; `wait` blocks on
+            // the fences (only when stopping)
+            void collect(bool wait)
+                {
+                    for (int i = 0; i < FRAME_CAPTURE_PBOS; i++)
+                        {
+                            CaptureSlot& slot = this->slots[(this->next + i) % FRAME_CAPTURE_PBOS];
+                            if (!slot.Fence)
+                                continue;
+                            GLenum status = glClientWaitSync(slot.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+                            if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+                                break;      // Later ones can't be done either
+                            glDeleteSync(slot.Fence);
+                            slot.Fence = 0;
+
+                            size_t bytes = (size_t)this->width * this->height * 4;
+                            FrameCaptureHeader header = { slot.Frame, this->width, this->height };
+                            if (!this->ring.Reserve(sizeof(header) + bytes))
+                                {
+                                    this->FramesDropped++;      // Writer is behind
+                                    continue;
+                                }
+
+                            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+                            void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_READ_BIT);
+                            if (mapped)
+                                {
+                                    this->ring.Put(&header, sizeof(header));
+                                    this->ring.Put(mapped, bytes);
+                                    this->ring.Commit();
+                                    this->FramesCaptured++;
+                                    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                                }
+                            else
+                                this->FramesDropped++;
+                            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                        }
+                }
+
+            void writerLoop()
+                {
+                    while (true)
+                        {
+                            bool stopping = !this->running;
+                            if (this->ring.Available() >= sizeof(FrameCaptureHeader))
+                                {
+                                    this->writeFrame();
+                                    continue;
+                                }
+                            if (stopping)
+                                break;
+                            this_thread::sleep_for(chrono::milliseconds(1));
+                        }
+                }
+
+            // Pulls one frame out of the ring and writes it
+            void writeFrame()
+                {
+                    PROFILE_SCOPE("Capture write");
+                    FrameCaptureHeader header;
+                    this->ring.Get(&header, sizeof(header));
+                    this->pixels.resize((size_t)header.Width * header.Height * 4);
+                    this->ring.Get(&this->pixels[0], this->pixels.size());
+                    this->ring.Release();
+
+                    if (this->format == FRAME_CAPTURE_PNG)
+                        {
+                            char name[32];
+                            snprintf(name, sizeof(name), "_%05lld.png", (long long)header.Frame);
+                            WritePNG(this->path + name, header.Width, header.Height, &this->pixels[0]);
+                        }
+                    else
+                        {
+                            this->repeatLast(header.Frame);
+                            this->toYUV420(header.Width, header.Height);
+                            fputs("FRAME\n", this->file);
+                            fwrite(&this->yuv[0], 1, this->yuv.size(), this->file);
+                            this->lastWritten = header.Frame;
+                        }
+                    this->FramesWritten++;
+                }
+
+            // Writes the last Y4M frame again for every frame dropped between it and `frame`
+            void repeatLast(long long frame)
+                {
+                    if (this->yuv.empty())
+                        return;
+                    for (; this->lastWritten + 1 < frame; this->lastWritten++)
+                        {
+                            fputs("FRAME\n", this->file);
+                            fwrite(&this->yuv[0], 1, this->yuv.size(), this->file);
+                            this->FramesRepeated++;
+                        }
+                }
+
+            // RGBA rows bottom-up (as read back) to top-down Y, U and V planes, full range BT.601;
+            // each chroma sample averages a 2x2 block
+            void toYUV420(int width, int height)
+                {
+                    int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+                    this->yuv.resize((size_t)width * height + 2 * (size_t)chromaWidth * chromaHeight);
+                    uint8_t* yPlane = &this->yuv[0];
+                    uint8_t* uPlane = yPlane + (size_t)width * height;
+                    uint8_t* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+
+                    for (int y = 0; y < height; y++)
+                        {
+                            const uint8_t* row = &this->pixels[(size_t)(height - 1 - y) * width * 4];
+                            uint8_t* out = yPlane + (size_t)y * width;
+                            for (int x = 0; x < width; x++)
+                                out[x] = (uint8_t)((77 * row[x * 4] + 150 * row[x * 4 + 1] + 29 * row[x * 4 + 2] + 128) >> 8);
+                        }
+
+                    for (int cy = 0; cy < chromaHeight; cy++)
+                        for (int cx = 0; cx < chromaWidth; cx++)
+                            {
+                                int r = 0, g = 0, b = 0, n = 0;
+                                for (int dy = 0; dy < 2; dy++)
+                                    for (int dx = 0; dx < 2; dx++)
+                                        {
+                                            int x = cx * 2 + dx, y = cy * 2 + dy;
+                                            if (x >= width || y >= height)
+                                                continue;
+                                            const uint8_t* p = &this->pixels[((size_t)(height - 1 - y) * width + x) * 4];
+                                            r += p[0];
+                                            g += p[1];
+                                            b += p[2];
+                                            n++;
+                                        }
+                                r /= n;
+                                g /= n;
+                                b /= n;
+                                uPlane[(size_t)cy * chromaWidth + cx] = (uint8_t)((-43 * r - 85 * g + 128 * b + 32768 + 128) >> 8);
+                                vPlane[(size_t)cy * chromaWidth + cx] = (uint8_t)((128 * r - 107 * g - 21 * b + 32768 + 128) >> 8);
+                            }
+                }
+    };
+
+
+// Screen recorder (V starts/stops a Y4M recording, Shift+V a PNG sequence)
+FrameCapture frameCapture;
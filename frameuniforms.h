@@ -0,0 +1,92 @@
+#pragma once
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "streambuffer.h"
+#include "profiler.h"
+
+
+// ====================================================================
+//  Per-frame camera uniforms shared by every shader program.
+//
+//  One std140 uniform buffer holds the view and projection matrices,
+//  their product, the camera position and the time. It is filled once
+//  per frame and bound at FRAME_UNIFORMS_BINDING; every Shader that
+//  declares the "FrameUniforms" block is pointed at that binding when it
+//  is linked, so adding programs adds no per-frame camera uploads.
+//  Once frameStream exists the block is written into it and bound with
+//  glBindBufferRange instead, so the upload never waits on the GPU.
+//
+//  GLSL side (std140 keeps the layout identical to FrameUniformsData):
+//
+//      layout (std140) uniform FrameUniforms
+//      {
+//          mat4 view;
+//          mat4 projection;
+//          mat4 viewProj;
+//          vec4 cameraPos;
+//          float time;
+//      };
+// ====================================================================
+
+
+// CPU copy of the block. Under std140 mat4s are 64 bytes and vec4s 16, so the
+// struct matches as long as the float at the end is padded out to 16 bytes.
+struct FrameUniformsData
+    {
+        glm::mat4 View;
+        glm::mat4 Projection;
+        glm::mat4 ViewProj;
+        glm::vec4 CameraPos;
+        GLfloat   Time;
+        GLfloat   Padding[3];
+    };
+
+
+class FrameUniforms
+    {
+        public:
+            GLuint UBO;
+            FrameUniformsData Data;
+
+            FrameUniforms() : UBO(0) {}
+
+            // Creates the buffer and attaches it to its binding point (needs a GL context)
+            void Create()
+                {
+                    glGenBuffers(1, &this->UBO);
+                    glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+                    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniformsData), NULL, GL_DYNAMIC_DRAW);
+                    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+                    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, this->UBO);
+                }
+
+            // Fills the block for this frame - one upload for all programs
+            void Update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos, GLfloat time)
+                {
+                    PROFILE_SCOPE("FrameUniforms::Update");
+                    this->Data.View = view;
+                    this->Data.Projection = projection;
+                    this->Data.ViewProj = projection * view;
+                    this->Data.CameraPos = glm::vec4(cameraPos, 1.0f);
+                    this->Data.Time = time;
+
+                    StreamAllocation allocation = frameStream.Allocate(sizeof(FrameUniformsData), frameStream.UniformAlignment);
+                    if (allocation.Ptr != NULL)
+                        {
+                            memcpy(allocation.Ptr, &this->Data, sizeof(FrameUniformsData));
+                            frameStream.Flush();
+                            glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frameStream.Buffer,
+                                              allocation.Offset, sizeof(FrameUniformsData));
+                            return;
+                        }
+
+                    glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+                    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniformsData), &this->Data);
+                    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+                    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, this->UBO);
+                }
+    };
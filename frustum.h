@@ -0,0 +1,228 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cmath>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// SIMD Includes - SSE2 is always there on x64, AVX is used when the compiler is told to (/arch:AVX)
+#include <immintrin.h>
+
+
+// ====================================================================
+//  Bounding volumes and view-frustum culling.
+//
+//  Every Mesh gets an axis-aligned box and a bounding sphere when it is
+//  loaded (Model::processMesh). Each frame the objects about to be drawn
+//  put their world-space spheres into a FrustumCuller, which tests them
+//  all against the six planes of projection * view in one pass, several
+//  spheres at a time, and only the visible ones are submitted.
+// ====================================================================
+
+
+#if defined(__AVX__)
+const int CULL_WIDTH = 8;
+#else
+const int CULL_WIDTH = 4;
+#endif
+
+
+struct BoundingBox
+    {
+        glm::vec3 Min;
+        glm::vec3 Max;
+    };
+
+
+struct BoundingSphere
+    {
+        glm::vec3 Center;
+        GLfloat   Radius;
+    };
+
+
+// Box and sphere around a set of points. The sphere is centred on the box,
+// which is not the tightest possible but is close for the meshes we load.
+template <typename VertexT>
+void ComputeBounds(const vector<VertexT>& vertices, BoundingBox& box, BoundingSphere& sphere)
+    {
+        box.Min = box.Max = glm::vec3(0.0f);
+        sphere.Center = glm::vec3(0.0f);
+        sphere.Radius = 0.0f;
+        if (vertices.empty())
+            return;
+
+        box.Min = box.Max = vertices[0].Position;
+        for (size_t i = 1; i < vertices.size(); i++)
+            {
+                box.Min = glm::min(box.Min, vertices[i].Position);
+                box.Max = glm::max(box.Max, vertices[i].Position);
+            }
+
+        sphere.Center = (box.Min + box.Max) * 0.5f;
+        GLfloat radiusSq = 0.0f;
+        for (size_t i = 0; i < vertices.size(); i++)
+            {
+                glm::vec3 d = vertices[i].Position - sphere.Center;
+                radiusSq = fmaxf(radiusSq, glm::dot(d, d));
+            }
+        sphere.Radius = sqrt(radiusSq);
+    }
+
+
+// Smallest box/sphere (centred on the box) holding both
+void MergeBounds(BoundingBox& box, BoundingSphere& sphere, const BoundingBox& otherBox, const BoundingSphere& otherSphere, bool first)
+    {
+        box.Min = first ? otherBox.Min : glm::min(box.Min, otherBox.Min);
+        box.Max = first ? otherBox.Max : glm::max(box.Max, otherBox.Max);
+        glm::vec3 center = (box.Min + box.Max) * 0.5f;
+        GLfloat radius = glm::length(otherSphere.Center - center) + otherSphere.Radius;
+        if (!first)
+            radius = fmaxf(radius, glm::length(sphere.Center - center) + sphere.Radius);
+        sphere.Center = center;
+        sphere.Radius = radius;
+    }
+
+
+// The sphere after `model` has moved, rotated and scaled it
+BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& model)
+    {
+        BoundingSphere result;
+        result.Center = glm::vec3(model * glm::vec4(sphere.Center, 1.0f));
+
+        // Non-uniform scale: the largest axis scale keeps the sphere conservative
+        GLfloat scaleSq = fmaxf(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+                          fmaxf(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])),
+                                glm::dot(glm::vec3(model[2]), glm::vec3(model[2]))));
+        result.Radius = sphere.Radius * sqrt(scaleSq);
+        return result;
+    }
+
+
+// The six planes (a, b, c, d with ax + by + cz + d >= 0 inside) of a view-projection matrix
+struct Frustum
+    {
+        glm::vec4 Planes[6];
+
+        Frustum() {}
+        Frustum(const glm::mat4& viewProj) { this->Extract(viewProj); }
+
+        // Gribb/Hartmann: each plane is the 4th row of the matrix plus or minus one of the others
+        void Extract(const glm::mat4& m)
+            {
+                glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+                glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+                glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+                glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+                this->Planes[0] = row3 + row0;      // Left
+                this->Planes[1] = row3 - row0;      // Right
+                this->Planes[2] = row3 + row1;      // Bottom
+                this->Planes[3] = row3 - row1;      // Top
+                this->Planes[4] = row3 + row2;      // Near
+                this->Planes[5] = row3 - row2;      // Far
+
+                // Normalise so plane distances are real distances to compare radii against
+                for (int p = 0; p < 6; p++)
+                    this->Planes[p] /= glm::length(glm::vec3(this->Planes[p]));
+            }
+    };
+
+
+class FrustumCuller
+    {
+        public:
+            // Spheres to test (one entry per object, padded to a multiple of CULL_WIDTH)
+            vector<GLfloat> CenterX, CenterY, CenterZ, Radius;
+            vector<unsigned char> Visible;     // Result of the last Cull, per object
+            int Count;
+
+            // Stats from the last Cull
+            int VisibleCount;
+            int CulledCount;
+
+            FrustumCuller() : Count(0), VisibleCount(0), CulledCount(0) {}
+
+            void Clear() { this->Count = 0; }
+
+            // Adds an object's world-space sphere and returns its index
+            int Add(const BoundingSphere& sphere)
+                {
+                    size_t padded = (size_t)((this->Count + CULL_WIDTH) / CULL_WIDTH) * CULL_WIDTH;
+                    if (this->CenterX.size() < padded)
+                        {
+                            this->CenterX.resize(padded);
+                            this->CenterY.resize(padded);
+                            this->CenterZ.resize(padded);
+                            this->Radius.resize(padded);
+                            this->Visible.resize(padded);
+                        }
+
+                    int i = this->Count++;
+                    this->CenterX[i] = sphere.Center.x;
+                    this->CenterY[i] = sphere.Center.y;
+                    this->CenterZ[i] = sphere.Center.z;
+                    this->Radius[i] = sphere.Radius;
+                    return i;
+                }
+
+            // Tests every sphere against `frustum`: a sphere is culled if it lies
+            // entirely behind any one plane
+            void Cull(const Frustum& frustum)
+                {
+                    // Padding lanes are set up to be culled and then ignored
+                    int padded = (this->Count + CULL_WIDTH - 1) / CULL_WIDTH * CULL_WIDTH;
+                    for (int i = this->Count; i < padded; i++)
+                        {
+                            this->CenterX[i] = this->CenterY[i] = this->CenterZ[i] = 0.0f;
+                            this->Radius[i] = -1.0e30f;
+                        }
+
+                    this->VisibleCount = 0;
+                    for (int i = 0; i < padded; i += CULL_WIDTH)
+                        {
+#if defined(__AVX__)
+                            __m256 x = _mm256_loadu_ps(&this->CenterX[i]), y = _mm256_loadu_ps(&this->CenterY[i]);
+                            __m256 z = _mm256_loadu_ps(&this->CenterZ[i]);
+                            __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&this->Radius[i]));
+                            __m256 outside = _mm256_setzero_ps();
+                            for (int p = 0; p < 6; p++)
+                                {
+                                    const glm::vec4& plane = frustum.Planes[p];
+                                    __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)),
+                                                                           _mm256_mul_ps(y, _mm256_set1_ps(plane.y))),
+                                                             _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane.z)),
+                                                                           _mm256_set1_ps(plane.w)));
+                                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, negRadius, _CMP_LT_OQ));
+                                }
+                            int mask = _mm256_movemask_ps(outside);
+#else
+                            __m128 x = _mm_loadu_ps(&this->CenterX[i]), y = _mm_loadu_ps(&this->CenterY[i]);
+                            __m128 z = _mm_loadu_ps(&this->CenterZ[i]);
+                            __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&this->Radius[i]));
+                            __m128 outside = _mm_setzero_ps();
+                            for (int p = 0; p < 6; p++)
+                                {
+                                    const glm::vec4& plane = frustum.Planes[p];
+                                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)),
+                                                                     _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                                          _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)),
+                                                                     _mm_set1_ps(plane.w)));
+                                    outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negRadius));
+                                }
+                            int mask = _mm_movemask_ps(outside);
+#endif
+                            for (int lane = 0; lane < CULL_WIDTH; lane++)
+                                {
+                                    unsigned char visible = (mask & (1 << lane)) ? 0 : 1;
+                                    this->Visible[i + lane] = visible;
+                                    if (i + lane < this->Count)
+                                        this->VisibleCount += visible;
+                                }
+                        }
+                    this->CulledCount = this->Count - this->VisibleCount;
+                }
+    };
@@ -0,0 +1,376 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+#include "streambuffer.h"
+
+
+// ====================================================================
+//  GeometryArena - one vertex buffer, one index buffer and one VAO that
+//  any number of meshes are packed into.
+//
+//  Each mesh only remembers where its vertices and indices start
+//  (MeshRange), so every mesh in the arena can be drawn without
+//  touching the VAO, and a list of them can go to the GPU in a single
+//  glMultiDrawElementsIndirect. Where that isn't available (it is core
+//  in GL 4.3, an extension before) MultiDraw falls back to one
+//  base-vertex draw per mesh, still without rebinding anything.
+//
+//  Ranges are only ever appended, so a Model loaded later can share an
+//  arena with earlier ones (Upload re-sends the whole lot).
+//
+//  A packed arena stores each vertex in 16 bytes instead of 32 (see
+//  PackedVertex) and, when no mesh has 65536 vertices or more, 16-bit
+//  indices. Positions come out of the attribute as 0..1 across the
+//  arena's bounds, so shaders drawing from an arena scale them back:
+//
+//      uniform vec3 vertexDecodeScale;     // Set per draw by Mesh::Bind
+//      uniform vec3 vertexDecodeOffset;
+//      vec3 p = position * vertexDecodeScale + vertexDecodeOffset;
+//
+//  For an unpacked arena these are 1 and 0, so the same shader draws both.
+//  Normals (10_10_10_2) and UVs (half floats) need no decoding.
+// ====================================================================
+
+
+struct Vertex
+    {
+        glm::vec3 Position;     // Position
+        glm::vec3 Normal;       // Normal
+        glm::vec2 TexCoords;    // TexCoords
+    };
+
+
+// Per-instance data for instanced drawing (vertex attributes 3-6 and 7)
+struct InstanceData
+    {
+        glm::mat4 Model;        // Model matrix
+        GLfloat Layer;          // Texture/layer index for this instance
+    };
+
+
+// Vertex layout of a packed arena - 16 bytes
+struct PackedVertex
+    {
+        GLushort Position[4];       // Unsigned normalised across the arena's bounds (4th is padding)
+        GLuint   Normal;            // GL_INT_2_10_10_10_REV, signed normalised
+        GLushort TexCoords[2];      // Half floats
+    };
+
+
+// Float to IEEE half, rounding to nearest (only needs the range UVs use)
+GLushort floatToHalf(GLfloat value)
+    {
+        GLuint bits;
+        memcpy(&bits, &value, 4);
+        GLuint sign = (bits >> 16) & 0x8000;
+        int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+        GLuint mantissa = bits & 0x7FFFFF;
+
+        if (exponent <= 0)                  // Too small: flush to zero
+            return (GLushort)sign;
+        if (exponent >= 31)                 // Too big: infinity
+            return (GLushort)(sign | 0x7C00);
+        GLuint half = sign | (exponent << 10) | (mantissa >> 13);
+        if (mantissa & 0x1000)              // Round (may carry into the exponent, which is still right)
+            half++;
+        return (GLushort)half;
+    }
+
+
+// Unit vector to signed normalised 10_10_10_2
+GLuint packNormal(const glm::vec3& n)
+    {
+        GLuint packed = 0;
+        for (int i = 0; i < 3; i++)
+            {
+                GLfloat c = n[i] < -1.0f ? -1.0f : (n[i] > 1.0f ? 1.0f : n[i]);
+                GLint q = (GLint)floorf(c * 511.0f + 0.5f);
+                packed |= ((GLuint)q & 0x3FF) << (10 * i);
+            }
+        return packed;
+    }
+
+
+// Where a mesh lives in its arena
+struct MeshRange
+    {
+        GLint  BaseVertex;      // Added to every index of the mesh
+        GLuint FirstIndex;
+        GLuint IndexCount;
+    };
+
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+    {
+        GLuint Count;
+        GLuint InstanceCount;
+        GLuint FirstIndex;
+        GLint  BaseVertex;
+        GLuint BaseInstance;
+    };
+
+
+class GeometryArena
+    {
+        public:
+            GLuint VAO;
+            vector<Vertex> Vertices;
+            vector<GLuint> Indices;         // Relative to each mesh's base vertex
+            bool Packed;                    // Upload as PackedVertex (set before the first Upload)
+
+            // What the arena ended up as on the GPU (see Upload)
+            GLenum IndexType;               // GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+            GLsizei IndexSize;
+            glm::vec3 DecodeScale, DecodeOffset;
+            size_t VertexBytes, IndexBytes;
+
+            GeometryArena(bool packed = false) : VAO(0), Packed(packed), IndexType(GL_UNSIGNED_INT), IndexSize(sizeof(GLuint)),
+                                                 DecodeScale(1.0f), DecodeOffset(0.0f), VertexBytes(0), IndexBytes(0),
+                                                 vbo(0), ebo(0), indirectBuffer(0), instanceVBO(0), instanceOffset(0), maxIndex(0) {}
+
+            // Appends a mesh and returns where it went. Call Upload() once everything is added.
+            MeshRange Add(const vector<Vertex>& vertices, const vector<GLuint>& indices)
+                {
+                    MeshRange range = { (GLint)this->Vertices.size(), (GLuint)this->Indices.size(), (GLuint)indices.size() };
+                    this->Vertices.insert(this->Vertices.end(), vertices.begin(), vertices.end());
+                    this->addIndices(indices);
+                    return range;
+                }
+
+            // Appends another index list for vertices already in the arena (e.g. a
+            // simplified LOD of a mesh), drawn with the same base vertex
+            MeshRange AddIndices(GLint baseVertex, const vector<GLuint>& indices)
+                {
+                    MeshRange range = { baseVertex, (GLuint)this->Indices.size(), (GLuint)indices.size() };
+                    this->addIndices(indices);
+                    return range;
+                }
+
+            // Sends the arena to the GPU, creating the buffers and VAO the first time
+            void Upload()
+                {
+                    if (this->VAO == 0)
+                        {
+                            glGenVertexArrays(1, &this->VAO);
+                            glGenBuffers(1, &this->vbo);
+                            glGenBuffers(1, &this->ebo);
+                        }
+
+                    glState.BindVertexArray(this->VAO);
+
+                    if (this->Packed)
+                        this->uploadPacked();
+                    else
+                        this->uploadFloat();
+
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+                    glState.BindVertexArray(0);
+                }
+
+            // Points attributes 3-7 at an array of InstanceData starting `offset` bytes
+            // into `instanceBuffer` (skipped if they already point there)
+            void BindInstances(GLuint instanceBuffer, GLintptr offset = 0)
+                {
+                    glState.BindVertexArray(this->VAO);
+                    if (this->instanceVBO == instanceBuffer && this->instanceOffset == offset)
+                        return;
+
+                    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+                    // A mat4 attribute takes 4 consecutive locations, one per column
+                    for (GLuint column = 0; column < 4; column++)
+                        {
+                            glEnableVertexAttribArray(3 + column);
+                            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                                  (GLvoid*)(offset + offsetof(InstanceData, Model) + column * sizeof(glm::vec4)));
+                            glVertexAttribDivisor(3 + column, 1);   // Advance once per instance, not per vertex
+                        }
+
+                    // Texture/layer index
+                    glEnableVertexAttribArray(7);
+                    glVertexAttribPointer(7, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                          (GLvoid*)(offset + offsetof(InstanceData, Layer)));
+                    glVertexAttribDivisor(7, 1);
+
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+                    this->instanceVBO = instanceBuffer;
+                    this->instanceOffset = offset;
+                }
+
+            // Draws one range, `instanceCount` times
+            void Draw(const MeshRange& range, GLsizei instanceCount = 1)
+                {
+                    glState.BindVertexArray(this->VAO);
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.IndexCount, this->IndexType,
+                                                      (GLvoid*)((size_t)range.FirstIndex * this->IndexSize),
+                                                      instanceCount, range.BaseVertex);
+                }
+
+            // Draws every command with a single call where the driver allows it
+            void MultiDraw(const vector<DrawElementsIndirectCommand>& commands)
+                {
+                    if (commands.empty())
+                        return;
+                    glState.BindVertexArray(this->VAO);
+
+                    if (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect)
+                        {
+                            // Commands go through this frame's part of the stream buffer; if
+                            // that is full, orphan and refill a buffer of our own instead
+                            GLsizeiptr bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+                            StreamAllocation allocation = frameStream.Allocate(bytes, sizeof(GLuint));
+                            if (allocation.Ptr != NULL)
+                                {
+                                    memcpy(allocation.Ptr, &commands[0], bytes);
+                                    frameStream.Flush();
+                                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, frameStream.Buffer);
+                                }
+                            else
+                                {
+                                    if (this->indirectBuffer == 0)
+                                        glGenBuffers(1, &this->indirectBuffer);
+                                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirectBuffer);
+                                    glBufferData(GL_DRAW_INDIRECT_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+                                    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, &commands[0]);
+                                }
+                            glMultiDrawElementsIndirect(GL_TRIANGLES, this->IndexType, (GLvoid*)allocation.Offset,
+                                                        (GLsizei)commands.size(), 0);
+                            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+                            return;
+                        }
+
+                    // Fallback: the same draws one at a time (BaseInstance is always 0 here)
+                    for (size_t i = 0; i < commands.size(); i++)
+                        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, commands[i].Count, this->IndexType,
+                                                          (GLvoid*)((size_t)commands[i].FirstIndex * this->IndexSize),
+                                                          commands[i].InstanceCount, commands[i].BaseVertex);
+                }
+
+            static DrawElementsIndirectCommand Command(const MeshRange& range, GLuint instanceCount = 1)
+                {
+                    DrawElementsIndirectCommand command = { range.IndexCount, instanceCount, range.FirstIndex, range.BaseVertex, 0 };
+                    return command;
+                }
+
+        private:
+            GLuint vbo, ebo;
+            GLuint indirectBuffer;
+            GLuint instanceVBO;     // Instance buffer attributes 3-7 point at (0 = none yet)
+            GLintptr instanceOffset;
+            GLuint maxIndex;        // Largest index added, to see if 16 bits will do
+
+            void addIndices(const vector<GLuint>& indices)
+                {
+                    for (size_t i = 0; i < indices.size(); i++)
+                        if (indices[i] > this->maxIndex)
+                            this->maxIndex = indices[i];
+                    this->Indices.insert(this->Indices.end(), indices.begin(), indices.end());
+                }
+
+            // Full floats, 32-bit indices
+            void uploadFloat()
+                {
+                    this->IndexType = GL_UNSIGNED_INT;
+                    this->IndexSize = sizeof(GLuint);
+                    this->DecodeScale = glm::vec3(1.0f);
+                    this->DecodeOffset = glm::vec3(0.0f);
+                    this->VertexBytes = this->Vertices.size() * sizeof(Vertex);
+                    this->IndexBytes = this->Indices.size() * sizeof(GLuint);
+
+                    glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+                    glBufferData(GL_ARRAY_BUFFER, this->VertexBytes, this->Vertices.empty() ? NULL : &this->Vertices[0], GL_STATIC_DRAW);
+
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo);
+                    glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->IndexBytes, this->Indices.empty() ? NULL : &this->Indices[0], GL_STATIC_DRAW);
+
+                    // Vertex Positions
+                    glEnableVertexAttribArray(0);
+                    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+
+                    // Vertex Normals
+                    glEnableVertexAttribArray(1);
+                    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                                          (GLvoid*)offsetof(Vertex, Normal));
+
+                    // Vertex Texture Coords
+                    glEnableVertexAttribArray(2);
+                    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                                          (GLvoid*)offsetof(Vertex, TexCoords));
+                }
+
+            // PackedVertex, and 16-bit indices if they fit
+            void uploadPacked()
+                {
+                    // Quantise positions across the bounds of everything in the arena
+                    glm::vec3 low(0.0f), high(0.0f);
+                    if (!this->Vertices.empty())
+                        low = high = this->Vertices[0].Position;
+                    for (size_t v = 1; v < this->Vertices.size(); v++)
+                        {
+                            low = glm::min(low, this->Vertices[v].Position);
+                            high = glm::max(high, this->Vertices[v].Position);
+                        }
+                    this->DecodeOffset = low;
+                    this->DecodeScale = glm::max(high - low, glm::vec3(1.0e-6f));
+
+                    vector<PackedVertex> packed(this->Vertices.size());
+                    for (size_t v = 0; v < this->Vertices.size(); v++)
+                        {
+                            const Vertex& source = this->Vertices[v];
+                            glm::vec3 unit = (source.Position - low) / this->DecodeScale;
+                            for (int i = 0; i < 3; i++)
+                                packed[v].Position[i] = (GLushort)floorf(unit[i] * 65535.0f + 0.5f);
+                            packed[v].Position[3] = 0;
+                            packed[v].Normal = packNormal(source.Normal);
+                            packed[v].TexCoords[0] = floatToHalf(source.TexCoords.x);
+                            packed[v].TexCoords[1] = floatToHalf(source.TexCoords.y);
+                        }
+                    this->VertexBytes = packed.size() * sizeof(PackedVertex);
+                    glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+                    glBufferData(GL_ARRAY_BUFFER, this->VertexBytes, packed.empty() ? NULL : &packed[0], GL_STATIC_DRAW);
+
+                    // Indices are relative to each mesh's base vertex, so only one mesh has to fit
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo);
+                    if (this->maxIndex < 65536)
+                        {
+                            vector<GLushort> shortIndices(this->Indices.begin(), this->Indices.end());
+                            this->IndexType = GL_UNSIGNED_SHORT;
+                            this->IndexSize = sizeof(GLushort);
+                            this->IndexBytes = shortIndices.size() * sizeof(GLushort);
+                            glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->IndexBytes, shortIndices.empty() ? NULL : &shortIndices[0],
+                                         GL_STATIC_DRAW);
+                        }
+                    else
+                        {
+                            this->IndexType = GL_UNSIGNED_INT;
+                            this->IndexSize = sizeof(GLuint);
+                            this->IndexBytes = this->Indices.size() * sizeof(GLuint);
+                            glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->IndexBytes, &this->Indices[0], GL_STATIC_DRAW);
+                        }
+
+                    // Vertex Positions (0..1 across the bounds; the shader applies DecodeScale/Offset)
+                    glEnableVertexAttribArray(0);
+                    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+                                          (GLvoid*)offsetof(PackedVertex, Position));
+
+                    // Vertex Normals
+                    glEnableVertexAttribArray(1);
+                    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex),
+                                          (GLvoid*)offsetof(PackedVertex, Normal));
+
+                    // Vertex Texture Coords
+                    glEnableVertexAttribArray(2);
+                    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                                          (GLvoid*)offsetof(PackedVertex, TexCoords));
+                }
+    };
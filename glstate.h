@@ -0,0 +1,118 @@
+#pragma once
+// Std. Includes
+#include <unordered_map>
+
+// GL Includes
+#include <GL/glew.h>
+
+
+// ====================================================================
+//  GLStateCache - remembers what is currently bound so redundant
+//  glUseProgram / glBindVertexArray / glBindTexture / sampler uniform
+//  calls can be skipped.
+//
+//  This only works if everything goes through the cache, so Shader::Use,
+//  Mesh and ShaderVariants use the global glState below rather than
+//  calling GL directly. Code that has to bind things behind its back must call
+//  Invalidate() afterwards.
+// ====================================================================
+
+
+const int GL_STATE_TEXTURE_UNITS = 16;
+
+
+class GLStateCache
+    {
+        public:
+            // Stats - calls made to GL vs. calls skipped because nothing changed
+            unsigned int Issued;
+            unsigned int Skipped;
+
+            GLStateCache() : Issued(0), Skipped(0) { this->Invalidate(); }
+
+            // Forget everything (e.g. after third-party code has touched GL state)
+            void Invalidate()
+                {
+                    this->program = (GLuint)-1;
+                    this->vao = (GLuint)-1;
+                    this->activeUnit = (GLuint)-1;
+                    for (int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+                        this->textures[i] = (GLuint)-1;
+                    this->samplers.clear();
+                }
+
+            void ResetStats() { this->Issued = this->Skipped = 0; }
+
+            void UseProgram(GLuint program)
+                {
+                    if (this->program == program) { this->Skipped++; return; }
+                    glUseProgram(program);
+                    this->program = program;
+                    this->Issued++;
+                }
+
+            void BindVertexArray(GLuint vao)
+                {
+                    if (this->vao == vao) { this->Skipped++; return; }
+                    glBindVertexArray(vao);
+                    this->vao = vao;
+                    this->Issued++;
+                }
+
+            void BindTexture(GLuint unit, GLenum target, GLuint texture)
+                {
+                    if (unit < GL_STATE_TEXTURE_UNITS && this->textures[unit] == texture) { this->Skipped++; return; }
+                    if (this->activeUnit != unit)
+                        {
+                            glActiveTexture(GL_TEXTURE0 + unit);
+                            this->activeUnit = unit;
+                        }
+                    glBindTexture(target, texture);
+                    if (unit < GL_STATE_TEXTURE_UNITS)
+                        this->textures[unit] = texture;
+                    this->Issued++;
+                }
+
+            // Points a sampler uniform of the current program at a texture unit
+            void SetSampler(GLint location, GLint unit)
+                {
+                    if (location < 0)
+                        return;
+                    unsigned long long key = ((unsigned long long)this->program << 32) | (unsigned int)location;
+                    std::unordered_map<unsigned long long, GLint>::iterator it = this->samplers.find(key);
+                    if (it != this->samplers.end() && it->second == unit) { this->Skipped++; return; }
+                    glUniform1i(location, unit);
+                    this->samplers[key] = unit;
+                    this->Issued++;
+                }
+
+            // Deletes a program and forgets its sampler values, since GL may hand
+            // the name out again to a new program
+            void DeleteProgram(GLuint program)
+                {
+                    glDeleteProgram(program);
+                    if (this->program == program)
+                        this->program = (GLuint)-1;
+                    std::unordered_map<unsigned long long, GLint>::iterator it = this->samplers.begin();
+                    while (it != this->samplers.end())
+                        {
+                            if ((GLuint)(it->first >> 32) == program)
+                                it = this->samplers.erase(it);
+                            else
+                                ++it;
+                        }
+                }
+
+            GLuint CurrentProgram() const { return this->program; }
+
+        private:
+            GLuint program;
+            GLuint vao;
+            GLuint activeUnit;
+            GLuint textures[GL_STATE_TEXTURE_UNITS];
+            std::unordered_map<unsigned long long, GLint> samplers;     // (program, location) -> unit
+    };
+
+
+// The one cache for the one GL context
+GLStateCache glState;
@@ -0,0 +1,118 @@
+#pragma once
+// Std. Includes
+#include <vector>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "profiler.h"
+
+
+// ====================================================================
+//  GPU profiler - times passes on the GPU and feeds the results into
+//  the CPU profiler's summary and trace (as thread 0, "GPU ...").
+//
+//      GPU_PROFILE_SCOPE("Scene");         // Times the rest of the block on the GPU
+//      gpuProfiler.EndFrame();             // Once a frame, before profiler.EndFrame()
+//
+//  Each pass has two GL_TIME_ELAPSED queries, alternating frames, so
+//  EndFrame reads last frame's result instead of stalling on this
+//  frame's. GL_TIME_ELAPSED queries can't nest: one GPU scope at a
+//  time, and only on the thread that owns the GL context.
+//
+//  Kept apart from profiler.h so the simulation headers don't need GL.
+// ====================================================================
+
+
+class GpuProfiler
+    {
+        public:
+            GpuProfiler() : parity(0), active(-1) {}
+
+            void Begin(const char* name)
+                {
+                    int pass = -1;
+                    for (size_t i = 0; i < this->passes.size(); i++)
+                        if (this->passes[i].Name == name)
+                            pass = (int)i;
+                    if (pass < 0)
+                        {
+                            GpuPass created;
+                            created.Name = name;
+                            glGenQueries(2, created.Queries);
+                            created.Pending[0] = created.Pending[1] = false;
+                            created.Submitted[0] = created.Submitted[1] = 0;
+                            this->passes.push_back(created);
+                            pass = (int)this->passes.size() - 1;
+                        }
+
+                    GpuPass& gpu = this->passes[pass];
+                    if (gpu.Pending[this->parity])          // Timed twice in one frame: keep the first
+                        return;
+                    glBeginQuery(GL_TIME_ELAPSED, gpu.Queries[this->parity]);
+                    gpu.Submitted[this->parity] = profiler.Now();
+                    this->active = pass;
+                }
+
+            void End()
+                {
+                    if (this->active < 0)
+                        return;
+                    glEndQuery(GL_TIME_ELAPSED);
+                    this->passes[this->active].Pending[this->parity] = true;
+                    this->active = -1;
+                }
+
+            // Once a frame: hands last frame's timings to the profiler
+            void EndFrame()
+                {
+                    // Last frame's queries are (almost always) done by now
+                    int previous = 1 - this->parity;
+                    for (size_t i = 0; i < this->passes.size(); i++)
+                        {
+                            GpuPass& gpu = this->passes[i];
+                            if (!gpu.Pending[previous])
+                                continue;
+                            GLuint64 elapsed = 0;
+                            glGetQueryObjectui64v(gpu.Queries[previous], GL_QUERY_RESULT, &elapsed);
+                            gpu.Pending[previous] = false;
+
+                            ProfileEvent event = { gpu.Name, gpu.Submitted[previous], gpu.Submitted[previous] + (long long)elapsed };
+                            profiler.GpuRing().Push(event);
+                        }
+                    this->parity = previous;
+                }
+
+        private:
+            struct GpuPass
+                {
+                    const char* Name;
+                    GLuint Queries[2];
+                    bool Pending[2];
+                    long long Submitted[2];
+                };
+
+            vector<GpuPass> passes;
+            int parity;
+            int active;
+    };
+
+
+// The one GPU profiler (render thread only)
+GpuProfiler gpuProfiler;
+
+
+class GpuProfileScope
+    {
+        public:
+            GpuProfileScope(const char* name) { gpuProfiler.Begin(name); }
+            ~GpuProfileScope() { gpuProfiler.End(); }
+    };
+
+
+#if defined(DISABLE_PROFILER)
+#define GPU_PROFILE_SCOPE(name)
+#else
+#define GPU_PROFILE_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#endif
@@ -0,0 +1,318 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+
+// Context creation without a window system (pick one at build time)
+#if defined(HEADLESS_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#elif defined(HEADLESS_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+#include "imagewriter.h"
+
+
+// ====================================================================
+//  Headless rendering - the normal render path with no window, for
+//  benchmarks and CI machines without a display.
+//
+//      GroupProject --headless [frames] [--png every] [--size WxH] [--record path]
+//
+//  The context comes from EGL (build with HEADLESS_EGL, link -lEGL;
+//  surfaceless on Mesa, a pbuffer elsewhere) or OSMesa (HEADLESS_OSMESA,
+//  link -lOSMesa). Both run on Mesa's llvmpipe with no GPU at all.
+//  On Linux, CMakeLists.txt builds it that way (HEADLESS_BACKEND).
+//  Frames are drawn into an offscreen framebuffer (Target) in place of
+//  the window's, for a fixed number of frames, on a fixed clock so
+//  every run simulates the same thing. Every `--png` frames the target
+//  is read back into frame_NNNNN.png. `--record` records the whole run
+//  through FrameCapture: to a Y4M video, or a path_NNNNN.png sequence
+//  when the path ends in .png.
+//
+//  Each frame is timed from start to glFinish, and the run ends with a
+//  mean/p50/p95/p99 frame-time report.
+// ====================================================================
+
+
+const int     HEADLESS_DEFAULT_FRAMES = 600;
+const GLfloat HEADLESS_FRAME_RATE     = 60.0f;      // The fixed clock the simulation sees
+
+#if defined(HEADLESS_EGL) && !defined(EGL_PLATFORM_SURFACELESS_MESA)
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+
+struct HeadlessOptions
+    {
+        bool Enabled;
+        int Frames;
+        int PngEvery;               // 0 for no images
+        GLint Width, Height;        // 0 keeps the window size
+        string RecordPath;          // Empty for no recording
+
+        HeadlessOptions() : Enabled(false), Frames(HEADLESS_DEFAULT_FRAMES), PngEvery(0), Width(0), Height(0) {}
+
+        // Whether --record asked for a PNG sequence (a path ending in .png) rather than a Y4M
+        bool RecordPng() const
+            {
+                return this->RecordPath.size() > 4 && this->RecordPath.compare(this->RecordPath.size() - 4, 4, ".png") == 0;
+            }
+    };
+
+
+// Reads --headless [frames], --png every, --size WxH and --record path off the command line
+HeadlessOptions ParseHeadlessOptions(int argc, char** argv)
+    {
+        HeadlessOptions options;
+        for (int i = 1; i < argc; i++)
+            {
+                if (strcmp(argv[i], "--headless") == 0)
+                    {
+                        options.Enabled = true;
+                        if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                            options.Frames = atoi(argv[++i]);
+                    }
+                else if (strcmp(argv[i], "--png") == 0 && i + 1 < argc)
+                    options.PngEvery = max(0, atoi(argv[++i]));
+                else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+                    sscanf(argv[++i], "%dx%d", &options.Width, &options.Height);
+                else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+                    options.RecordPath = argv[++i];
+            }
+        return options;
+    }
+
+
+// Frame durations and their distribution
+class FrameTimeReport
+    {
+        public:
+            vector<double> Seconds;
+
+            void Add(double seconds) { this->Seconds.push_back(seconds); }
+
+            // The `p`th percentile (0..100, nearest rank)
+            double Percentile(double p) const
+                {
+                    if (this->Seconds.empty())
+                        return 0.0;
+                    vector<double> sorted(this->Seconds);
+                    sort(sorted.begin(), sorted.end());
+                    size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.999999);
+                    return sorted[min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+                }
+
+            double Mean() const
+                {
+                    double total = 0.0;
+                    for (size_t i = 0; i < this->Seconds.size(); i++)
+                        total += this->Seconds[i];
+                    return this->Seconds.empty() ? 0.0 : total / this->Seconds.size();
+                }
+
+            void Print(ostream& out) const
+                {
+                    out << fixed << setprecision(3) << this->Seconds.size() << " frames: mean " << this->Mean() * 1000.0
+                        << " ms, p50 " << this->Percentile(50) * 1000.0 << " ms, p95 " << this->Percentile(95) * 1000.0
+                        << " ms, p99 " << this->Percentile(99) * 1000.0 << " ms (" << (this->Mean() > 0.0 ? 1.0 / this->Mean() : 0.0)
+                        << " fps)\n";
+                }
+    };
+
+
+class HeadlessRenderer
+    {
+        public:
+            HeadlessOptions Options;
+            FrameTimeReport Report;
+            GLuint Target;                  // Framebuffer drawn into instead of the window's
+            int Frame;
+
+            HeadlessRenderer() : Target(0), Frame(0), colorBuffer(0), depthBuffer(0), started(chrono::steady_clock::now())
+                {
+#if defined(HEADLESS_EGL)
+                    this->display = EGL_NO_DISPLAY;
+                    this->surface = EGL_NO_SURFACE;
+                    this->context = EGL_NO_CONTEXT;
+#elif defined(HEADLESS_OSMESA)
+                    this->context = NULL;
+#endif
+                }
+
+            // Makes a GL 3.3 core context current with no window; false if this build
+            // has no headless backend or the platform won't give us a context
+            bool CreateContext(GLint width, GLint height)
+                {
+#if defined(HEADLESS_EGL)
+                    // Mesa's surfaceless platform needs no display server at all
+                    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+                    if (getPlatformDisplay)
+                        this->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+                    if (this->display == EGL_NO_DISPLAY)
+                        this->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+                    if (this->display == EGL_NO_DISPLAY || !eglInitialize(this->display, NULL, NULL))
+                        return false;
+
+                    const EGLint configAttributes[] = {
+                        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8, EGL_DEPTH_SIZE, 24,
+                        EGL_NONE };
+                    EGLConfig config;
+                    EGLint configCount = 0;
+                    if (!eglChooseConfig(this->display, configAttributes, &config, 1, &configCount) || configCount == 0)
+                        {
+                            // Surfaceless displays may offer no pbuffer configs; any GL one will do without a surface
+                            const EGLint anyAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+                            if (!eglChooseConfig(this->display, anyAttributes, &config, 1, &configCount) || configCount == 0)
+                                return false;
+                        }
+
+                    if (!eglBindAPI(EGL_OPENGL_API))
+                        return false;
+                    const EGLint contextAttributes[] = {
+                        EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                        EGL_NONE };
+                    this->context = eglCreateContext(this->display, config, EGL_NO_CONTEXT, contextAttributes);
+                    if (this->context == EGL_NO_CONTEXT)
+                        return false;
+
+                    // Everything is drawn into Target, so a surface is only made where EGL insists
+                    const char* extensions = eglQueryString(this->display, EGL_EXTENSIONS);
+                    if (extensions == NULL || strstr(extensions, "EGL_KHR_surfaceless_context") == NULL)
+                        {
+                            const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+                            this->surface = eglCreatePbufferSurface(this->display, config, surfaceAttributes);
+                        }
+                    return eglMakeCurrent(this->display, this->surface, this->surface, this->context) == EGL_TRUE;
+#elif defined(HEADLESS_OSMESA)
+                    const int contextAttributes[] = {
+                        OSMESA_FORMAT, OSMESA_RGBA, OSMESA_DEPTH_BITS, 24,
+                        OSMESA_PROFILE, OSMESA_CORE_PROFILE, OSMESA_CONTEXT_MAJOR_VERSION, 3, OSMESA_CONTEXT_MINOR_VERSION, 3,
+                        0 };
+                    this->context = OSMesaCreateContextAttribs(contextAttributes, NULL);
+                    if (this->context == NULL)
+                        return false;
+                    this->osmesaBuffer.resize((size_t)width * height * 4);
+                    return OSMesaMakeCurrent(this->context, &this->osmesaBuffer[0], GL_UNSIGNED_BYTE, width, height) == GL_TRUE;
+#else
+                    (void)width;
+                    (void)height;
+                    cout << "\nHeadless rendering needs a build with HEADLESS_EGL or HEADLESS_OSMESA defined...";
+                    return false;
+#endif
+                }
+
+            // Creates Target at `width` x `height` (needs the context and GLEW)
+            void CreateTarget(GLint width, GLint height)
+                {
+                    this->width = width;
+                    this->height = height;
+
+                    glGenRenderbuffers(1, &this->colorBuffer);
+                    glBindRenderbuffer(GL_RENDERBUFFER, this->colorBuffer);
+                    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+                    glGenRenderbuffers(1, &this->depthBuffer);
+                    glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+                    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+                    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+                    glGenFramebuffers(1, &this->Target);
+                    glBindFramebuffer(GL_FRAMEBUFFER, this->Target);
+                    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->colorBuffer);
+                    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+                    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                        cout << "ERROR::HEADLESS:: target framebuffer is incomplete\n";
+                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+                    this->frameStart = chrono::steady_clock::now();
+                }
+
+            // Time the simulation sees: a fixed HEADLESS_FRAME_RATE clock, so runs repeat exactly
+            GLdouble Time() const { return this->Frame / (GLdouble)HEADLESS_FRAME_RATE; }
+
+            // Real seconds since the program started (Time() is the simulated clock)
+            double Elapsed() const { return chrono::duration<double>(chrono::steady_clock::now() - this->started).count(); }
+
+            bool Done() const { return this->Frame >= this->Options.Frames; }
+
+            // Call where the window would swap: waits for the frame to finish, times it,
+            // and writes it out if it's a --png frame
+            void EndFrame()
+                {
+                    glFinish();
+                    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+                    this->Report.Add(chrono::duration<double>(now - this->frameStart).count());
+
+                    if (this->Options.PngEvery > 0 && this->Frame % this->Options.PngEvery == 0)
+                        {
+                            this->pixels.resize((size_t)this->width * this->height * 4);
+                            glBindFramebuffer(GL_READ_FRAMEBUFFER, this->Target);
+                            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+                            glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, &this->pixels[0]);
+                            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+                            char name[32];
+                            snprintf(name, sizeof(name), "frame_%05d.png", this->Frame);
+                            if (!WritePNG(name, this->width, this->height, &this->pixels[0]))
+                                cout << "ERROR::HEADLESS:: couldn't write " << name << "\n";
+                        }
+
+                    this->Frame++;
+                    this->frameStart = chrono::steady_clock::now();       // Image writing isn't part of the frame
+                }
+
+            void Destroy()
+                {
+                    glDeleteFramebuffers(1, &this->Target);
+                    glDeleteRenderbuffers(1, &this->colorBuffer);
+                    glDeleteRenderbuffers(1, &this->depthBuffer);
+#if defined(HEADLESS_EGL)
+                    if (this->display != EGL_NO_DISPLAY)
+                        {
+                            eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                            if (this->surface != EGL_NO_SURFACE)
+                                eglDestroySurface(this->display, this->surface);
+                            eglDestroyContext(this->display, this->context);
+                            eglTerminate(this->display);
+                        }
+#elif defined(HEADLESS_OSMESA)
+                    if (this->context)
+                        OSMesaDestroyContext(this->context);
+#endif
+                }
+
+        private:
+            GLint width, height;
+            GLuint colorBuffer, depthBuffer;
+            vector<unsigned char> pixels;
+            chrono::steady_clock::time_point frameStart;
+            chrono::steady_clock::time_point started;
+
+#if defined(HEADLESS_EGL)
+            EGLDisplay display;
+            EGLSurface surface;
+            EGLContext context;
+#elif defined(HEADLESS_OSMESA)
+            OSMesaContext context;
+            vector<unsigned char> osmesaBuffer;
+#endif
+    };
+
+
+// Headless run state (Options.Enabled is false for a normal windowed run)
+HeadlessRenderer headless;
@@ -0,0 +1,68 @@
+//
+//  headless_batch.cpp
+//
+//  Runs the ball physics for many independent tables in parallel, with no
+//  window and no OpenGL, and reports how many tables were simulated per
+//  second. Intended for offline shot-evaluation runs on servers without
+//  a display.
+//
+//  This is a separate console program with its own main(), so it is not
+//  part of GroupProject.vcxproj. Build it with e.g.
+//
+//      cl /O2 /EHsc headless_batch.cpp
+//      g++ -O2 -std=c++11 -pthread headless_batch.cpp -o headless_batch
+//
+//  Usage:
+//      headless_batch [tables] [simSeconds] [threads] [ccd]
+//
+//  e.g. "headless_batch 10000 10 0 ccd" simulates 10000 breaks for 10
+//  seconds each on every core, using event-driven physics.
+//
+// ========================================================================
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "tablebatch.h"
+
+
+int main(int argc, char** argv)
+{
+    int tableCount = argc > 1 ? atoi(argv[1]) : 1000;
+    TableBatchSettings settings;
+    if (argc > 2)
+        settings.SimSeconds = atof(argv[2]);
+    if (argc > 3)
+        settings.Threads = atoi(argv[3]);
+    if (argc > 4 && strcmp(argv[4], "ccd") == 0)
+        {
+            settings.UseCCD = true;
+            settings.TickRate = CCD_PHYSICS_HZ;
+        }
+    if (tableCount < 1)
+        tableCount = 1;
+
+    // Every table gets a rack and a break shot with a different angle and power
+    vector<BallSystem> tables(tableCount);
+    srand(12345);
+    for (int t = 0; t < tableCount; t++)
+        {
+            float angle = 0.2f * (2.0f * rand() / RAND_MAX - 1.0f);
+            float power = 100.0f + 400.0f * rand() / RAND_MAX;
+            SetupRack(tables[t], 0.0f);
+            tables[t].VX[0] = power * cos(angle);
+            tables[t].VY[0] = power * sin(angle);
+        }
+
+    printf("Simulating %d tables for %.1f s each (%s, %.0f Hz)...\n", tableCount, settings.SimSeconds,
+           settings.UseCCD ? "event-driven CCD" : "fixed step", settings.TickRate);
+
+    TableBatchResult result = SimulateTables(tables, settings);
+
+    printf("Threads          : %d\n", result.Threads);
+    printf("Wall time        : %.3f s\n", result.WallSeconds);
+    printf("Tables / second  : %.1f\n", result.TablesPerSecond);
+    printf("Ticks / second   : %.3g\n", result.WallSeconds > 0.0 ? result.Ticks / result.WallSeconds : 0.0);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <string>
+#include <cstdio>
+using namespace std;
+
+
+// ====================================================================
+//  Writing rendered frames to disk without any image library.
+//
+//  WritePNG stores RGBA8 rows uncompressed (deflate "stored" blocks), so
+//  files are about the size of the raw pixels but cost almost nothing to
+//  write. Rows are taken bottom-up, the way glReadPixels returns them.
+// ====================================================================
+
+
+// CRC-32 (PNG chunks) over `length` bytes, continuing from `crc`
+unsigned int ImageCrc32(const unsigned char* data, size_t length, unsigned int crc = 0)
+    {
+        static unsigned int table[256];
+        static bool built = false;
+        if (!built)
+            {
+                for (unsigned int n = 0; n < 256; n++)
+                    {
+                        unsigned int c = n;
+                        for (int k = 0; k < 8; k++)
+                            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                        table[n] = c;
+                    }
+                built = true;
+            }
+
+        crc = ~crc;
+        for (size_t i = 0; i < length; i++)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+
+// Big-endian 32-bit value, as PNG wants everything
+void imagePutBE32(vector<unsigned char>& out, unsigned int value)
+    {
+        out.push_back((unsigned char)(value >> 24));
+        out.push_back((unsigned char)(value >> 16));
+        out.push_back((unsigned char)(value >> 8));
+        out.push_back((unsigned char)value);
+    }
+
+
+void imageWriteChunk(FILE* file, const char* type, const vector<unsigned char>& data)
+    {
+        vector<unsigned char> chunk;
+        imagePutBE32(chunk, (unsigned int)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        imagePutBE32(chunk, ImageCrc32(&chunk[4], chunk.size() - 4));
+        fwrite(&chunk[0], 1, chunk.size(), file);
+    }
+
+
+// Writes `width` x `height` RGBA8 pixels (bottom row first) as a PNG
+bool WritePNG(const string& path, int width, int height, const unsigned char* pixels)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == NULL)
+            return false;
+
+        static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        fwrite(signature, 1, 8, file);
+
+        vector<unsigned char> header;
+        imagePutBE32(header, (unsigned int)width);
+        imagePutBE32(header, (unsigned int)height);
+        header.push_back(8);        // Bits per channel
+        header.push_back(6);        // RGBA
+        header.push_back(0);        // Deflate
+        header.push_back(0);        // Adaptive filtering (every row says "none")
+        header.push_back(0);        // Not interlaced
+        imageWriteChunk(file, "IHDR", header);
+
+        // Filtered rows (a zero byte before each), top row first
+        size_t rowBytes = (size_t)width * 4;
+        vector<unsigned char> raw;
+        raw.reserve((rowBytes + 1) * height);
+        for (int y = height - 1; y >= 0; y--)
+            {
+                raw.push_back(0);
+                raw.insert(raw.end(), pixels + y * rowBytes, pixels + (y + 1) * rowBytes);
+            }
+
+        // zlib stream of stored blocks (at most 65535 bytes each), then the Adler-32 of the rows
+        vector<unsigned char> zlib;
+        zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+        zlib.push_back(0x78);
+        zlib.push_back(0x01);
+        size_t offset = 0;
+        do
+            {
+                size_t block = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+                zlib.push_back(offset + block == raw.size() ? 1 : 0);     // Last block?
+                zlib.push_back((unsigned char)block);
+                zlib.push_back((unsigned char)(block >> 8));
+                zlib.push_back((unsigned char)~block);
+                zlib.push_back((unsigned char)(~block >> 8));
+                zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+                offset += block;
+            }
+        while (offset < raw.size());
+
+        unsigned int a = 1, b = 0;
+        for (size_t i = 0; i < raw.size(); i++)
+            {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+        imagePutBE32(zlib, (b << 16) | a);
+        imageWriteChunk(file, "IDAT", zlib);
+
+        imageWriteChunk(file, "IEND", vector<unsigned char>());
+        bool written = ferror(file) == 0;
+        fclose(file);
+        return written;
+    }
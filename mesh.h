@@ -12,12 +12,17 @@ using namespace std;
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "geometryarena.h"
+#include "frustum.h"
+#include "simplify.h"
+#include "vertexcache.h"
 
-struct Vertex
+
+// One level of detail: where its indices are in the arena, and how far it strays from the full mesh
+struct MeshLod
     {
-        glm::vec3 Position;     // Position
-        glm::vec3 Normal;       // Normal
-        glm::vec2 TexCoords;    // TexCoords
+        MeshRange Range;
+        GLfloat Error;
     };
 
 
@@ -26,6 +31,7 @@ struct Texture
         GLuint id;
         string type;
         aiString path;
+        GLenum target;          // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY once packed (see Model::PackTextures)
     };
 
 
@@ -34,17 +40,32 @@ struct Texture
 class Mesh
     {
         private:
-            GLuint VBO, EBO;        //  Render data
-            void setupMesh();       // Initializes all the buffer objects/arrays
+            vector<string> samplerNames;        // Sampler each texture is bound to ("texture_diffuse1", ...)
+            vector<GLint> samplerLocations;     // ...and their locations in samplerProgram
+            GLint decodeScaleLocation, decodeOffsetLocation;
+            GLuint samplerProgram;
+            vector<SimplifiedLevel> lodLevels;  // Built by GenerateLods, moved into the arena by Upload
+            void setupSamplerNames();
         
         public:
             vector<Vertex> vertices;        //  Mesh Data
             vector<GLuint> indices;
             vector<Texture> textures;
-            GLuint VAO;
+            GeometryArena* Arena;           // Where the render data lives (shared with the rest of the Model)
+            MeshRange Range;
+            BoundingBox Bounds;             // Model-space bounding volumes (see Model::processMesh)
+            BoundingSphere Sphere;
+            vector<MeshLod> Lods;           // Lods[0] is the full mesh (Range); the rest get coarser
 
             Mesh(vector<Vertex>, vector<GLuint>, vector<Texture>);      // Constructor
-            void Draw(Shader);                                          // Render the mesh
+            void GenerateLods();                                        // Builds simplified versions of the mesh
+            void Upload(GeometryArena&);                                // Packs the mesh (and its LODs) into an arena
+            const MeshRange& LodRange(int lod) const;                   // Range of a LOD (clamped to the coarsest)
+            void Draw(Shader&);                                         // Render the mesh
+            void DrawInstanced(Shader&, GLuint instanceBuffer, GLsizei count, GLintptr offset = 0); // Render `count` copies in one call
+            void Bind(Shader&);                                         // Textures and vertex decode uniforms
+            bool SameTextures(const Mesh&) const;                       // Can share a MultiDraw with `other`
+            void SetTextures(const vector<Texture>&);                   // Swaps in new textures (and their sampler names)
     };
 
 
@@ -55,25 +76,116 @@ Mesh::Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> text
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->Arena = NULL;
+        this->samplerProgram = 0;
+        this->decodeScaleLocation = this->decodeOffsetLocation = -1;
+        
+        // The vertex buffers are set up by Upload, once the Model knows which arena the mesh goes in
+        this->setupSamplerNames();
+    }
+
+
+
+// Simplifies the mesh into a chain of LODs by quadric edge collapse (simplify.h)
+void Mesh::GenerateLods()
+    {
+        this->lodLevels = BuildLodChain(this->vertices, this->indices);
+
+        // Collapses scramble the triangle order, so put each level back in cache order
+        for (size_t i = 0; i < this->lodLevels.size(); i++)
+            OptimizeVertexCache(this->lodLevels[i].Indices, this->vertices.size());
+    }
+
+
+
+// Appends the mesh to `arena`, followed by the indices of each of its LODs, which
+// reuse the mesh's vertices. The arena still has to be uploaded afterwards.
+void Mesh::Upload(GeometryArena& arena)
+    {
+        this->Arena = &arena;
+        this->Range = arena.Add(this->vertices, this->indices);
+
+        this->Lods.clear();
+        MeshLod full = { this->Range, 0.0f };
+        this->Lods.push_back(full);
+        for (size_t i = 0; i < this->lodLevels.size(); i++)
+            {
+                MeshLod lod = { arena.AddIndices(this->Range.BaseVertex, this->lodLevels[i].Indices), this->lodLevels[i].Error };
+                this->Lods.push_back(lod);
+            }
+        this->lodLevels.clear();
+    }
+
+
+
+const MeshRange& Mesh::LodRange(int lod) const
+    {
+        if (this->Lods.empty())
+            return this->Range;
+        return this->Lods[lod < (int)this->Lods.size() ? lod : this->Lods.size() - 1].Range;
+    }
+
+
+
+void Mesh::Draw(Shader& shader)
+    {
+        this->Bind(shader);
         
-        // Now that we have all the required data, set the vertex buffers and its attribute pointers.
-        this->setupMesh();
+        // Draw mesh. Textures and the VAO are left bound: the state cache skips
+        // rebinding them if the next draw uses the same ones.
+        this->Arena->Draw(this->Range);
+    }
+
+
+
+
+// Draws `count` instances of the mesh with one instanced draw. Each instance's
+// model matrix and layer index come from an array of InstanceData `offset`
+// bytes into `instanceBuffer` (see Model::DrawInstanced).
+void Mesh::DrawInstanced(Shader& shader, GLuint instanceBuffer, GLsizei count, GLintptr offset)
+    {
+        this->Arena->BindInstances(instanceBuffer, offset);
+        this->Bind(shader);
+        this->Arena->Draw(this->Range, count);
+    }
+
+
+
+bool Mesh::SameTextures(const Mesh& other) const
+    {
+        if (this->Arena != other.Arena || this->textures.size() != other.textures.size())
+            return false;
+        for (GLuint i = 0; i < this->textures.size(); i++)
+            if (this->textures[i].id != other.textures[i].id || this->samplerNames[i] != other.samplerNames[i])
+                return false;
+        return true;
     }
 
 
 
-void Mesh::Draw(Shader shader)
+
+void Mesh::SetTextures(const vector<Texture>& textures)
+    {
+        this->textures = textures;
+        this->samplerNames.clear();
+        this->setupSamplerNames();
+        this->samplerProgram = 0;               // Look the sampler locations up again
+    }
+
+
+
+
+// Works out, once, which sampler each texture goes to. We assume a convention
+// for sampler names in the shaders: texture_diffuseN, texture_specularN, ...
+// Other types (such as texture_diffuse_array) are used as the sampler name as they are.
+void Mesh::setupSamplerNames()
     {
-        // Bind appropriate textures
         GLuint diffuseNr = 1;
         GLuint specularNr = 1;
         for(GLuint i = 0; i < this->textures.size(); i++)
             {
-                glActiveTexture(GL_TEXTURE0 + i); // Activate proper texture unit before binding
-                
                 // Retrieve texture number (the N in diffuse_textureN)
                 stringstream ss;
-                string number;
                 string name = this->textures[i].type;
                 
                 if(name == "texture_diffuse")
@@ -81,73 +193,39 @@ void Mesh::Draw(Shader shader)
                 else if(name == "texture_specular")
                         ss << specularNr++;             // Transfer GLuint to stream
                 
-                number = ss.str();
-                
-                // Now set the sampler to the correct texture unit
-                glUniform1f(glGetUniformLocation(shader.Program, (name + number).c_str()), i);
-                
-                // And finally bind the texture
-                glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
-            }
-        
-        // Draw mesh
-        glBindVertexArray(this->VAO);
-        glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        
-        // Set everything back to defaults once configured.
-        for (GLuint i = 0; i < this->textures.size(); i++)
-            {
-                glActiveTexture(GL_TEXTURE0 + i);
-                glBindTexture(GL_TEXTURE_2D, 0);
+                this->samplerNames.push_back(name + ss.str());
             }
     }
 
 
 
-
-// Initializes all the buffer objects/arrays
-void Mesh::setupMesh()
+// Binds each texture to its own unit and points the matching sampler at it, and
+// tells the shader how to decode the arena's positions (see geometryarena.h)
+void Mesh::Bind(Shader& shader)
     {
-        // Create buffers/arrays
-        glGenVertexArrays(1, &this->VAO);
-        glGenBuffers(1, &this->VBO);
-        glGenBuffers(1, &this->EBO);
-        
-        glBindVertexArray(this->VAO);
-        
-        // Load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-        
-        // A great thing about structs is that their memory layout is sequential
-        // for all its items. The effect is that we can simply pass a pointer to
-        // the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex),
-                     &this->vertices[0], GL_STATIC_DRAW);
-        
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint),
-                     &this->indices[0], GL_STATIC_DRAW);
-        
-        
-        // Set the vertex attribute pointers
-        
-        // Vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-        
-        // Vertex Normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (GLvoid*)offsetof(Vertex, Normal));
+        // Sampler locations only change with the program, so look them up once per program
+        if (this->samplerProgram != shader.Program)
+            {
+                this->samplerLocations.resize(this->samplerNames.size());
+                for (GLuint i = 0; i < this->samplerNames.size(); i++)
+                    this->samplerLocations[i] = shader.Uniform(this->samplerNames[i]);
+                this->decodeScaleLocation = shader.Uniform("vertexDecodeScale");
+                this->decodeOffsetLocation = shader.Uniform("vertexDecodeOffset");
+                this->samplerProgram = shader.Program;
+            }
         
-        // Vertex Texture Coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (GLvoid*)offsetof(Vertex, TexCoords));
+        if (this->decodeScaleLocation >= 0)
+            shader.Set(this->decodeScaleLocation, this->Arena->DecodeScale);
+        if (this->decodeOffsetLocation >= 0)
+            shader.Set(this->decodeOffsetLocation, this->Arena->DecodeOffset);
         
-        glBindVertexArray(0);
+        for(GLuint i = 0; i < this->textures.size(); i++)
+            {
+                // Set the sampler to the correct texture unit, then bind the texture
+                // (both skipped by the state cache when nothing changed)
+                glState.SetSampler(this->samplerLocations[i], i);
+                glState.BindTexture(i, this->textures[i].target, this->textures[i].id);
+            }
     }
 
 
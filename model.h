@@ -19,6 +19,10 @@ using namespace std;
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "renderqueue.h"
+#include "streambuffer.h"
+#include "vertexcache.h"
+#include "texturearray.h"
 
 
 GLint TextureFromFile(const char* path, bool gamma = false);
@@ -38,18 +42,160 @@ class Model
             vector<Mesh> meshes;
             string directory;
             bool gammaCorrection;
-
-            // Constructor, expects a filepath to a 3D model.
-            Model(GLchar* path, bool gamma = false) : gammaCorrection(gamma)
+            GeometryArena* Arena;               // Vertex/index buffers of every mesh (own, or shared with other models)
+            BoundingBox Bounds;                 // Around every mesh, in model space
+            BoundingSphere Sphere;
+            vector<GLfloat> LodErrors;          // Per level of detail, the largest error of any mesh
+
+            // Constructor, expects a filepath to a 3D model. Models given the same
+            // `arena` share one VAO and can be drawn together.
+            Model(GLchar* path, bool gamma = false, GeometryArena* arena = NULL) : gammaCorrection(gamma)
                 {
+                    this->Bounds.Min = this->Bounds.Max = this->Sphere.Center = glm::vec3(0.0f);
+                    this->Sphere.Radius = 0.0f;
+                    this->Arena = arena != NULL ? arena : &this->ownArena;
                     this->loadModel(path);
                 }
 
-            // Draws the model, and thus all its meshes
-            void Draw(Shader shader)
+            // Draws the model, and thus all its meshes, with one multi-draw per set of textures
+            void Draw(Shader& shader, int lod = 0)
+            {
+                this->drawBatched(shader, 1, lod);
+            }
+
+            // Draws one copy of the model per entry in `instances`, with a single
+            // instanced draw call per mesh (the shader reads attributes 3-7)
+            void DrawInstanced(Shader& shader, const vector<InstanceData>& instances, int lod = 0)
+            {
+                if (instances.empty())
+                    return;
+
+                GLintptr offset;
+                GLuint buffer = this->uploadInstances(instances, offset);
+                this->Arena->BindInstances(buffer, offset);
+                this->drawBatched(shader, (GLuint)instances.size(), lod);
+            }
+
+            // Queues the model's meshes on `queue` instead of drawing them straight away
+            void Submit(RenderQueue& queue, Shader& shader, GLint modelLocation, const glm::mat4& model, int lod = 0)
             {
                 for(GLuint i = 0; i < this->meshes.size(); i++)
-                    this->meshes[i].Draw(shader);
+                    queue.Submit(shader, this->meshes[i], modelLocation, model, lod);
+            }
+
+            // Queued version of DrawInstanced. The instances are copied into this
+            // frame's part of frameStream now, so `instances` can be reused straight away.
+            void SubmitInstanced(RenderQueue& queue, Shader& shader, const vector<InstanceData>& instances, int lod = 0)
+            {
+                if (instances.empty())
+                    return;
+
+                GLintptr offset;
+                GLuint buffer = this->uploadInstances(instances, offset);
+                for(GLuint i = 0; i < this->meshes.size(); i++)
+                    queue.SubmitInstanced(shader, this->meshes[i], buffer, (GLsizei)instances.size(), offset, lod);
+            }
+
+            // Moves the model's diffuse texture into a layer of `array` and has the meshes bind
+            // the array instead, as "texture_diffuse_array" (for shaders compiled with
+            // SHADER_TEXTURE_ARRAY), then frees the texture it replaces. Returns the layer, or -1
+            // if nothing was packed. The array still has to be uploaded afterwards.
+            //
+            // The layer drawn is picked per instance, not per mesh, so only a model whose
+            // meshes all share one diffuse texture can be packed.
+            GLint PackTextures(TextureArray& array)
+            {
+                Texture diffuse = { 0, "", aiString(), GL_TEXTURE_2D };
+                for(GLuint i = 0; i < this->meshes.size(); i++)
+                    for(GLuint j = 0; j < this->meshes[i].textures.size(); j++)
+                        {
+                            const Texture& texture = this->meshes[i].textures[j];
+                            if (texture.type != "texture_diffuse" || texture.id == diffuse.id)
+                                continue;
+                            if (diffuse.id != 0)
+                                {
+                                    cout << "ERROR::TEXTURE_ARRAY:: " << this->directory
+                                         << " has more than one diffuse texture; left unpacked" << endl;
+                                    return -1;
+                                }
+                            diffuse = texture;
+                        }
+                if (diffuse.id == 0)
+                    return -1;
+
+                GLint layer = array.Add(diffuse.path.C_Str());
+                if (layer < 0)
+                    return -1;
+
+                Texture packed = { array.ID, "texture_diffuse_array", diffuse.path, GL_TEXTURE_2D_ARRAY };
+                for(GLuint i = 0; i < this->meshes.size(); i++)
+                    {
+                        vector<Texture> textures = this->meshes[i].textures;
+                        for(GLuint j = 0; j < textures.size(); j++)
+                            if (textures[j].id == diffuse.id)
+                                textures[j] = packed;
+                        this->meshes[i].SetTextures(textures);
+                    }
+
+                // The array has its own copy now
+                for(GLuint i = 0; i < this->textures_loaded.size(); )
+                    if (this->textures_loaded[i].id == diffuse.id)
+                        this->textures_loaded.erase(this->textures_loaded.begin() + i);
+                    else
+                        i++;
+                glDeleteTextures(1, &diffuse.id);
+                glState.Invalidate();       // It may still be recorded as bound
+                return layer;
+            }
+
+            // Level of detail for a copy of the model whose bounding sphere ends up at
+            // `world`, given the LOD it used last frame. `pixelsPerUnit` is how many
+            // pixels tall something one unit high is, one unit in front of the camera.
+            int SelectLod(const BoundingSphere& world, const glm::vec3& cameraPos, GLfloat pixelsPerUnit, int current) const
+            {
+                if (this->LodErrors.size() < 2 || this->Sphere.Radius <= 0.0f)
+                    return 0;
+
+                GLfloat distance = fmaxf(glm::length(world.Center - cameraPos) - world.Radius, 1.0f);
+                GLfloat pixelsPerError = pixelsPerUnit * (world.Radius / this->Sphere.Radius) / distance;
+                int lod = current < (int)this->LodErrors.size() ? current : (int)this->LodErrors.size() - 1;
+
+                while (lod + 1 < (int)this->LodErrors.size() &&
+                       this->LodErrors[lod + 1] * pixelsPerError < LOD_PIXEL_ERROR * LOD_HYSTERESIS)
+                    lod++;
+                while (lod > 0 && this->LodErrors[lod] * pixelsPerError > LOD_PIXEL_ERROR)
+                    lod--;
+                return lod;
+            }
+
+        private:
+            GeometryArena ownArena;
+            vector<DrawElementsIndirectCommand> drawCommands;
+
+            Model(const Model&);                    // Arena may point at ownArena: not copyable
+            Model& operator=(const Model&);
+
+            // Meshes next to each other that use the same textures go out in one MultiDraw
+            void drawBatched(Shader& shader, GLuint instanceCount, int lod)
+            {
+                for(GLuint first = 0; first < this->meshes.size(); )
+                    {
+                        this->drawCommands.clear();
+                        GLuint last = first;
+                        while (last < this->meshes.size() && this->meshes[last].SameTextures(this->meshes[first]))
+                            this->drawCommands.push_back(GeometryArena::Command(this->meshes[last++].LodRange(lod), instanceCount));
+
+                        this->meshes[first].Bind(shader);
+                        this->Arena->MultiDraw(this->drawCommands);
+                        first = last;
+                    }
+            }
+
+            // Copies the instances to the GPU; returns the buffer and sets where in it they start.
+            // They stay there until the next frame, however many other uploads follow.
+            GLuint uploadInstances(const vector<InstanceData>& instances, GLintptr& offset)
+            {
+                return frameStream.Upload(&instances[0], instances.size() * sizeof(InstanceData), sizeof(InstanceData), offset);
             }
     
     
@@ -74,6 +220,26 @@ void Model::loadModel(string path)
 
         // Process ASSIMP's root node recursively
         this->processNode(scene->mRootNode, scene);
+
+        // Pack every mesh into the arena and send it to the GPU in one go
+        for(GLuint i = 0; i < this->meshes.size(); i++)
+            this->meshes[i].Upload(*this->Arena);
+        this->Arena->Upload();
+
+        // The model's bounds hold all of its meshes
+        for(GLuint i = 0; i < this->meshes.size(); i++)
+            MergeBounds(this->Bounds, this->Sphere, this->meshes[i].Bounds, this->meshes[i].Sphere, i == 0);
+
+        // A model LOD is as far off as its worst mesh at that level
+        this->LodErrors.clear();
+        for(GLuint i = 0; i < this->meshes.size(); i++)
+            {
+                const vector<MeshLod>& lods = this->meshes[i].Lods;
+                if (this->LodErrors.size() < lods.size())
+                    this->LodErrors.resize(lods.size(), this->LodErrors.empty() ? 0.0f : this->LodErrors.back());
+                for (GLuint level = 0; level < this->LodErrors.size(); level++)
+                    this->LodErrors[level] = fmaxf(this->LodErrors[level], lods[level < lods.size() ? level : lods.size() - 1].Error);
+            }
     }
 
 
@@ -160,6 +326,18 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
                     indices.push_back(face.mIndices[j]);
             }
         
+        // Weld duplicate vertices and reorder for the post-transform cache, overdraw
+        // and vertex fetch (vertexcache.h), reporting how much the cache gains
+        size_t verticesBefore = vertices.size();
+        GLfloat acmrBefore = ComputeACMR(indices, vertices.size());
+        WeldVertices(vertices, indices);
+        vector<size_t> clusters;
+        OptimizeVertexCache(indices, vertices.size(), &clusters);
+        OptimizeOverdraw(indices, vertices, clusters);
+        OptimizeVertexFetch(vertices, indices);
+        cout << "Mesh \"" << mesh->mName.C_Str() << "\": " << verticesBefore << " -> " << vertices.size()
+             << " vertices, ACMR " << acmrBefore << " -> " << ComputeACMR(indices, vertices.size()) << endl;
+        
         // Process materials
 //        if(mesh->mMaterialIndex >= 0)   // mMaterialIndex will always be >= 0 (unsigned int), but...
             {
@@ -183,8 +361,11 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
                 textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
             }
         
-        // Return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // Return a mesh object created from the extracted mesh data, with its bounding volumes
+        Mesh result(vertices, indices, textures);
+        ComputeBounds(result.vertices, result.Bounds, result.Sphere);
+        result.GenerateLods();
+        return result;
     }
 
 
@@ -218,6 +399,7 @@ vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type,
                         texture.id = TextureFromFile(str.C_Str());
                         texture.type = typeName;
                         texture.path = str;
+                        texture.target = GL_TEXTURE_2D;
                         textures.push_back(texture);
                         this->textures_loaded.push_back(texture);   // Store it as texture loaded for
                                                                     // entire model, to ensure we won't
@@ -242,8 +424,8 @@ GLint TextureFromFile(const char* texturePath, bool gamma)
         int width,height;
         unsigned char* image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
         
-        // Assign texture to ID
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        // Assign texture to ID (through the state cache, so it knows what is bound)
+        glState.BindTexture(0, GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, gamma ? GL_SRGB : GL_RGB, width, height, 0, GL_RGB,
                       GL_UNSIGNED_BYTE, image);
         glGenerateMipmap(GL_TEXTURE_2D);	
@@ -253,7 +435,7 @@ GLint TextureFromFile(const char* texturePath, bool gamma)
         glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
         glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
         glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        glState.BindTexture(0, GL_TEXTURE_2D, 0);
         SOIL_free_image_data(image);
         return textureID;
     }
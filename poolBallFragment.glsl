@@ -1,10 +1,26 @@
 #version 330 core
+// Permutations (see ShaderVariants in shader.h):
+//   TEXTURE_ARRAY      - every ball's texture is a layer of one array, picked per instance (see texturearray.h)
 in vec2 TexCoords;
-out vec4 color;
+in vec3 Normal;
+flat in float Layer;
 
+// Scene targets (see postprocess.h): colour, and the view-space normal packed into 0..1
+layout (location = 0) out vec4 color;
+layout (location = 1) out vec4 normalOut;
+
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray texture_diffuse_array;
+#else
 uniform sampler2D texture_diffuse1;
+#endif
 
 void main()
 {
+#ifdef TEXTURE_ARRAY
+    color = texture(texture_diffuse_array, vec3(TexCoords, Layer));
+#else
     color = texture(texture_diffuse1, TexCoords);
+#endif
+    normalOut = vec4(normalize(Normal) * 0.5f + 0.5f, 1.0f);
 }
@@ -1,15 +1,53 @@
 #version 330 core
+// Permutations (see ShaderVariants in shader.h):
+//   INSTANCED          - model matrix and texture layer come per instance (see InstanceData in geometryarena.h)
+//   PACKED_POSITIONS   - positions are 0..1 across the arena's bounds and need decoding (see geometryarena.h)
 layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoords;
 
+#ifdef INSTANCED
+layout (location = 3) in mat4 instanceModel;
+layout (location = 7) in float instanceLayer;
+#else
+uniform mat4 model;
+#endif
+
 out vec2 TexCoords;
+out vec3 Normal;            // View space, for the edge pass (see postprocess.h)
+flat out float Layer;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+// Shared per-frame camera block (see frameuniforms.h)
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProj;
+    vec4 cameraPos;
+    float time;
+};
+
+#ifdef PACKED_POSITIONS
+uniform vec3 vertexDecodeScale;
+uniform vec3 vertexDecodeOffset;
+#endif
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); 
+#ifdef PACKED_POSITIONS
+    vec3 objectPosition = position * vertexDecodeScale + vertexDecodeOffset;
+#else
+    vec3 objectPosition = position;
+#endif
+
+#ifdef INSTANCED
+    gl_Position = viewProj * instanceModel * vec4(objectPosition, 1.0f);
+    Normal = mat3(view * instanceModel) * normal;
+    Layer = instanceLayer;
+#else
+    gl_Position = viewProj * model * vec4(objectPosition, 1.0f);
+    Normal = mat3(view * model) * normal;
+    Layer = 0.0f;
+#endif
     TexCoords = texCoords;
 }
@@ -0,0 +1,18 @@
+#version 330 core
+// Final pass (see postprocess.h): the scene colour darkened along the edges,
+// which are upscaled from the edge target's resolution by bilinear filtering
+in vec2 TexCoords;
+
+out vec4 color;
+
+uniform sampler2D sceneColor;
+uniform sampler2D edges;
+uniform vec3 edgeColor;
+uniform float edgeStrength;
+
+void main()
+{
+    vec3 scene = texture(sceneColor, TexCoords).rgb;
+    float edge = texture(edges, TexCoords).r * edgeStrength;
+    color = vec4(mix(scene, edgeColor, edge), 1.0f);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+// One triangle covering the screen, from gl_VertexID alone (draw 3 vertices, no buffers)
+out vec2 TexCoords;
+
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    TexCoords = corner;
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,239 @@
+#pragma once
+// Std. Includes
+#include <iostream>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "glstate.h"
+#include "gpuprofiler.h"
+
+
+// ====================================================================
+//  PostProcess - renders the scene offscreen and outlines it.
+//
+//      BeginScene()    binds the scene framebuffer: colour, view-space
+//                      normal (MRT location 1) and depth textures
+//      ...draw...
+//      Apply()         edge detection, then the composite to the window
+//
+//  Edges come from a Sobel filter over log depth and the normals, so
+//  silhouettes and creases are found, not texture detail. The filter is
+//  run separably - a horizontal pass writing [-1 0 1] differences and
+//  [1 2 1] sums, then a vertical pass combining them - at EdgeScale of
+//  the window's resolution: 0.5 does a quarter of the work for softer
+//  lines. The composite upsamples the edges bilinearly.
+//
+//  Each pass is timed on the GPU through the profiler ("GPU Sobel
+//  horizontal", "GPU Sobel vertical", "GPU Composite" in its summary).
+//
+//  Shaders that only write colour leave the normal target undefined
+//  where they draw; write location 1 to be outlined properly.
+// ====================================================================
+
+
+const GLfloat EDGE_RESOLUTION_SCALE = 0.5f;     // Edge targets' size relative to the window
+const GLfloat EDGE_DEPTH_WEIGHT     = 1.0f;     // Per doubling of distance
+const GLfloat EDGE_NORMAL_WEIGHT    = 0.5f;
+const GLfloat EDGE_THRESHOLD        = 0.5f;     // Sobel magnitude where lines start to appear
+const GLfloat EDGE_STRENGTH         = 0.85f;
+
+
+class PostProcess
+    {
+        public:
+            bool Enabled;
+            GLfloat EdgeScale;
+            GLint Width, Height;                // Window framebuffer
+            GLint EdgeWidth, EdgeHeight;        // Edge targets
+            GLuint OutputFBO;                   // What Apply composites into: the window (0), or headless.Target
+
+            // Scene targets
+            GLuint SceneFBO, ColorTexture, NormalTexture, DepthTexture;
+
+            // Edge targets: the horizontal pass's difference and smoothing, then the edges
+            GLuint HorizontalFBO, DifferenceTexture, SmoothedTexture;
+            GLuint EdgeFBO, EdgeTexture;
+
+            PostProcess() : Enabled(true), EdgeScale(EDGE_RESOLUTION_SCALE), Width(0), Height(0), EdgeWidth(0), EdgeHeight(0), OutputFBO(0),
+                            SceneFBO(0), ColorTexture(0), NormalTexture(0), DepthTexture(0),
+                            HorizontalFBO(0), DifferenceTexture(0), SmoothedTexture(0), EdgeFBO(0), EdgeTexture(0),
+                            nearPlane(1.0f), farPlane(1.0f), emptyVAO(0),
+                            sobelHorizontal(NULL), sobelVertical(NULL), composite(NULL)
+                {
+                }
+
+            ~PostProcess()
+                {
+                    delete this->sobelHorizontal;
+                    delete this->sobelVertical;
+                    delete this->composite;
+                }
+
+            // Creates the targets for a `width` x `height` window and a camera with the
+            // given near/far planes, and compiles the passes (needs a GL context)
+            void Create(GLint width, GLint height, GLfloat nearPlane, GLfloat farPlane, GLfloat edgeScale = EDGE_RESOLUTION_SCALE)
+                {
+                    this->Width = width;
+                    this->Height = height;
+                    this->nearPlane = nearPlane;
+                    this->farPlane = farPlane;
+
+                    this->sobelHorizontal = new Shader("postFullscreenVertex.glsl", "edgeSobelHorizontalFragment.glsl");
+                    this->sobelVertical = new Shader("postFullscreenVertex.glsl", "edgeSobelVerticalFragment.glsl");
+                    this->composite = new Shader("postFullscreenVertex.glsl", "postCompositeFragment.glsl");
+                    glGenVertexArrays(1, &this->emptyVAO);      // Core profile draws need a VAO, even with no attributes
+
+                    this->ColorTexture = this->createTexture(width, height, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST);
+                    this->NormalTexture = this->createTexture(width, height, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST);
+                    this->DepthTexture = this->createTexture(width, height, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, GL_NEAREST);
+
+                    glGenFramebuffers(1, &this->SceneFBO);
+                    glBindFramebuffer(GL_FRAMEBUFFER, this->SceneFBO);
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->ColorTexture, 0);
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->NormalTexture, 0);
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->DepthTexture, 0);
+                    GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+                    glDrawBuffers(2, drawBuffers);
+                    this->checkFramebuffer("scene");
+
+                    glGenFramebuffers(1, &this->HorizontalFBO);
+                    glGenFramebuffers(1, &this->EdgeFBO);
+                    this->SetEdgeScale(edgeScale);
+                }
+
+            // Resizes the edge targets to `scale` of the window (clamped to 1/8 .. 1)
+            void SetEdgeScale(GLfloat scale)
+                {
+                    this->EdgeScale = glm::clamp(scale, 0.125f, 1.0f);
+                    this->EdgeWidth = max(1, (GLint)(this->Width * this->EdgeScale));
+                    this->EdgeHeight = max(1, (GLint)(this->Height * this->EdgeScale));
+
+                    glDeleteTextures(1, &this->DifferenceTexture);
+                    glDeleteTextures(1, &this->SmoothedTexture);
+                    glDeleteTextures(1, &this->EdgeTexture);
+                    glState.Invalidate();       // The deleted names may still be cached as bound
+                    this->DifferenceTexture = this->createTexture(this->EdgeWidth, this->EdgeHeight, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_NEAREST);
+                    this->SmoothedTexture = this->createTexture(this->EdgeWidth, this->EdgeHeight, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_NEAREST);
+                    this->EdgeTexture = this->createTexture(this->EdgeWidth, this->EdgeHeight, GL_R8, GL_RED, GL_UNSIGNED_BYTE, GL_LINEAR);
+
+                    glBindFramebuffer(GL_FRAMEBUFFER, this->HorizontalFBO);
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->DifferenceTexture, 0);
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->SmoothedTexture, 0);
+                    GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+                    glDrawBuffers(2, drawBuffers);
+                    this->checkFramebuffer("Sobel horizontal");
+
+                    glBindFramebuffer(GL_FRAMEBUFFER, this->EdgeFBO);
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->EdgeTexture, 0);
+                    this->checkFramebuffer("edges");
+                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                }
+
+            // Binds and clears what the scene is drawn into: the offscreen targets, or
+            // OutputFBO straight away when post-processing is off
+            void BeginScene(const glm::vec4& clearColor)
+                {
+                    glBindFramebuffer(GL_FRAMEBUFFER, this->Enabled ? this->SceneFBO : this->OutputFBO);
+                    glViewport(0, 0, this->Width, this->Height);
+                    glClearColor(clearColor.r, clearColor.g, clearColor.b, clearColor.a);
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    if (this->Enabled)
+                        {
+                            GLfloat noNormal[4] = { 0.5f, 0.5f, 0.5f, 0.0f };       // Decodes to a zero vector
+                            glClearBufferfv(GL_COLOR, 1, noNormal);
+                        }
+                }
+
+            // Finds the edges and composites the scene into the window
+            void Apply()
+                {
+                    if (!this->Enabled)
+                        return;
+                    PROFILE_SCOPE("PostProcess::Apply");
+
+                    glDisable(GL_DEPTH_TEST);
+                    glState.BindVertexArray(this->emptyVAO);
+                    glm::vec2 edgeTexel(1.0f / this->EdgeWidth, 1.0f / this->EdgeHeight);
+
+                    // 1. Horizontal half of the Sobel, at edge resolution
+                    {
+                        GPU_PROFILE_SCOPE("Sobel horizontal");
+                        glBindFramebuffer(GL_FRAMEBUFFER, this->HorizontalFBO);
+                        glViewport(0, 0, this->EdgeWidth, this->EdgeHeight);
+                        Shader& pass = *this->sobelHorizontal;
+                        pass.Use();
+                        this->bindTexture(pass, "sceneDepth", 0, this->DepthTexture);
+                        this->bindTexture(pass, "sceneNormal", 1, this->NormalTexture);
+                        pass.Set("texelSize", edgeTexel);
+                        pass.Set("depthRange", glm::vec2(this->nearPlane, this->farPlane));
+                        pass.Set("depthWeight", EDGE_DEPTH_WEIGHT);
+                        pass.Set("normalWeight", EDGE_NORMAL_WEIGHT);
+                        glDrawArrays(GL_TRIANGLES, 0, 3);
+                    }
+
+                    // 2. Vertical half, thresholded into the edge target
+                    {
+                        GPU_PROFILE_SCOPE("Sobel vertical");
+                        glBindFramebuffer(GL_FRAMEBUFFER, this->EdgeFBO);
+                        Shader& pass = *this->sobelVertical;
+                        pass.Use();
+                        this->bindTexture(pass, "horizontalDifference", 0, this->DifferenceTexture);
+                        this->bindTexture(pass, "horizontalSmoothed", 1, this->SmoothedTexture);
+                        pass.Set("texelSize", edgeTexel);
+                        pass.Set("threshold", EDGE_THRESHOLD);
+                        glDrawArrays(GL_TRIANGLES, 0, 3);
+                    }
+
+                    // 3. Scene colour with the edges drawn over it, into the window
+                    {
+                        GPU_PROFILE_SCOPE("Composite");
+                        glBindFramebuffer(GL_FRAMEBUFFER, this->OutputFBO);
+                        glViewport(0, 0, this->Width, this->Height);
+                        Shader& pass = *this->composite;
+                        pass.Use();
+                        this->bindTexture(pass, "sceneColor", 0, this->ColorTexture);
+                        this->bindTexture(pass, "edges", 1, this->EdgeTexture);
+                        pass.Set("edgeColor", glm::vec3(0.0f));
+                        pass.Set("edgeStrength", EDGE_STRENGTH);
+                        glDrawArrays(GL_TRIANGLES, 0, 3);
+                    }
+
+                    glEnable(GL_DEPTH_TEST);
+                }
+
+        private:
+            GLfloat nearPlane, farPlane;
+            GLuint emptyVAO;
+            Shader* sobelHorizontal;
+            Shader* sobelVertical;
+            Shader* composite;
+
+            GLuint createTexture(GLint width, GLint height, GLint internalFormat, GLenum format, GLenum type, GLint filter)
+                {
+                    GLuint texture;
+                    glGenTextures(1, &texture);
+                    glState.BindTexture(0, GL_TEXTURE_2D, texture);
+                    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                    return texture;
+                }
+
+            void bindTexture(Shader& pass, const char* sampler, GLuint unit, GLuint texture)
+                {
+                    glState.SetSampler(pass.Uniform(sampler), unit);
+                    glState.BindTexture(unit, GL_TEXTURE_2D, texture);
+                }
+
+            void checkFramebuffer(const char* name)
+                {
+                    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                        cout << "ERROR::POSTPROCESS:: " << name << " framebuffer is incomplete\n";
+                }
+    };
@@ -0,0 +1,278 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+using namespace std;
+
+
+// ====================================================================
+//  Profiler - CPU scope timers on any thread, a rolling per-scope
+//  summary and Chrome trace export (chrome://tracing or ui.perfetto.dev).
+//
+//      PROFILE_SCOPE("Physics");           // Times the rest of the block
+//      profiler.EndFrame();                // Once a frame: gathers everything up
+//
+//  Scope names must be string literals (only the pointer is stored).
+//
+//  Each thread writes its scopes into its own ring without locking; the
+//  thread calling EndFrame is the only reader. If a ring fills up before
+//  EndFrame drains it, new scopes are dropped and counted.
+//
+//  No GL in here, so the simulation headers can use it on machines
+//  without a display. GPU pass timers (GPU_PROFILE_SCOPE) are in
+//  gpuprofiler.h and hand their results in through GpuRing().
+//
+//  Build with DISABLE_PROFILER defined to compile the macros out.
+// ====================================================================
+
+
+const int PROFILE_RING_SIZE     = 4096;     // Scopes a thread can record between EndFrames
+const int PROFILE_HISTORY       = 300;      // Samples per scope the summary is taken over
+
+
+struct ProfileEvent
+    {
+        const char* Name;
+        long long Start;        // Nanoseconds since the profiler started
+        long long End;
+    };
+
+
+// Single-producer/single-consumer ring of one thread's events
+class ProfileRing
+    {
+        public:
+            int ThreadId;
+            atomic<unsigned int> Dropped;
+
+            ProfileRing(int threadId) : ThreadId(threadId), Dropped(0), head(0), tail(0) {}
+
+            // Writer (owning thread)
+            void Push(const ProfileEvent& event)
+                {
+                    unsigned int head = this->head.load(memory_order_relaxed);
+                    if (head - this->tail.load(memory_order_acquire) >= (unsigned int)PROFILE_RING_SIZE)
+                        {
+                            this->Dropped.fetch_add(1, memory_order_relaxed);
+                            return;
+                        }
+                    this->events[head % PROFILE_RING_SIZE] = event;
+                    this->head.store(head + 1, memory_order_release);
+                }
+
+            // Reader (EndFrame)
+            template <typename F>
+            void Drain(F consume)
+                {
+                    unsigned int tail = this->tail.load(memory_order_relaxed);
+                    unsigned int head = this->head.load(memory_order_acquire);
+                    for (; tail != head; tail++)
+                        consume(this->events[tail % PROFILE_RING_SIZE]);
+                    this->tail.store(tail, memory_order_release);
+                }
+
+        private:
+            ProfileEvent events[PROFILE_RING_SIZE];
+            atomic<unsigned int> head, tail;
+    };
+
+
+// Rolling window of one scope's durations
+struct ProfileStats
+    {
+        vector<long long> Samples;      // Nanoseconds, ring of PROFILE_HISTORY
+        int Next;
+        long long Count;
+
+        ProfileStats() : Next(0), Count(0) {}
+
+        void Add(long long duration)
+            {
+                if ((int)this->Samples.size() < PROFILE_HISTORY)
+                    this->Samples.push_back(duration);
+                else
+                    this->Samples[this->Next] = duration;
+                this->Next = (this->Next + 1) % PROFILE_HISTORY;
+                this->Count++;
+            }
+    };
+
+
+class Profiler
+    {
+        public:
+            Profiler() : epoch(chrono::steady_clock::now()), gpuRing(0), capturing(false), nextThreadId(1) {}
+
+            long long Now() const
+                {
+                    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - this->epoch).count();
+                }
+
+            // The calling thread's ring, created the first time it records anything
+            ProfileRing& ThreadRing()
+                {
+                    static thread_local ProfileRing* ring = NULL;
+                    if (ring == NULL)
+                        {
+                            lock_guard<mutex> lock(this->ringsLock);
+                            this->rings.push_back(unique_ptr<ProfileRing>(new ProfileRing(this->nextThreadId++)));
+                            ring = this->rings.back().get();
+                        }
+                    return *ring;
+                }
+
+            // Where gpuprofiler.h puts finished GPU passes (thread 0 in the summary and trace)
+            ProfileRing& GpuRing() { return this->gpuRing; }
+
+            // Once a frame, on the render thread: drains every thread's ring
+            void EndFrame()
+                {
+                    {
+                        lock_guard<mutex> lock(this->ringsLock);
+                        for (size_t r = 0; r < this->rings.size(); r++)
+                            {
+                                int threadId = this->rings[r]->ThreadId;
+                                this->rings[r]->Drain([&](const ProfileEvent& event)
+                                    {
+                                        this->record(event, threadId);
+                                    });
+                            }
+                    }
+
+                    this->gpuRing.Drain([&](const ProfileEvent& event)
+                        {
+                            this->record(event, 0);
+                        });
+                }
+
+            // Chrome trace capture: everything recorded between Start and Stop
+            void StartCapture()
+                {
+                    this->trace.clear();
+                    this->capturing = true;
+                }
+
+            bool IsCapturing() const { return this->capturing; }
+
+            bool StopCapture(const string& path)
+                {
+                    this->capturing = false;
+                    ofstream file(path.c_str());
+                    if (!file)
+                        return false;
+
+                    file << "{\"traceEvents\":[\n";
+                    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+                    for (size_t i = 0; i < this->trace.size(); i++)
+                        {
+                            const TraceEvent& e = this->trace[i];
+                            file << ",\n{\"name\":\"" << e.Event.Name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.ThreadId
+                                 << ",\"ts\":" << fixed << setprecision(3) << e.Event.Start / 1000.0
+                                 << ",\"dur\":" << (e.Event.End - e.Event.Start) / 1000.0 << "}";
+                        }
+                    file << "\n]}\n";
+                    return true;
+                }
+
+            // min/avg/p99 of the last PROFILE_HISTORY samples of every scope, in milliseconds
+            void PrintSummary(ostream& out)
+                {
+                    out << left << setw(28) << "Scope" << right << setw(10) << "min" << setw(10) << "avg"
+                        << setw(10) << "p99" << setw(10) << "count" << "\n";
+
+                    vector<long long> sorted;
+                    for (map<string, ProfileStats>::iterator it = this->stats.begin(); it != this->stats.end(); ++it)
+                        {
+                            sorted = it->second.Samples;
+                            if (sorted.empty())
+                                continue;
+                            sort(sorted.begin(), sorted.end());
+                            long long total = 0;
+                            for (size_t i = 0; i < sorted.size(); i++)
+                                total += sorted[i];
+                            size_t p99 = min(sorted.size() - 1, (size_t)(sorted.size() * 0.99));
+
+                            out << left << setw(28) << it->first << right << fixed << setprecision(3)
+                                << setw(10) << sorted[0] / 1.0e6
+                                << setw(10) << total / 1.0e6 / sorted.size()
+                                << setw(10) << sorted[p99] / 1.0e6
+                                << setw(10) << it->second.Count << "\n";
+                        }
+
+                    unsigned int dropped = 0;
+                    {
+                        lock_guard<mutex> lock(this->ringsLock);
+                        for (size_t r = 0; r < this->rings.size(); r++)
+                            dropped += this->rings[r]->Dropped.load();
+                    }
+                    if (dropped > 0)
+                        out << dropped << " scopes dropped (ring full)\n";
+                }
+
+        private:
+            struct TraceEvent
+                {
+                    ProfileEvent Event;
+                    int ThreadId;
+                };
+
+            chrono::steady_clock::time_point epoch;
+            mutex ringsLock;                                // Guards the list, not the rings
+            vector<unique_ptr<ProfileRing> > rings;
+            ProfileRing gpuRing;
+            map<string, ProfileStats> stats;
+            vector<TraceEvent> trace;
+            bool capturing;
+            int nextThreadId;                               // 0 is the GPU
+
+            void record(const ProfileEvent& event, int threadId)
+                {
+                    ProfileStats& scope = this->stats[threadId == 0 ? string("GPU ") + event.Name : string(event.Name)];
+                    scope.Add(event.End - event.Start);
+                    if (this->capturing)
+                        {
+                            TraceEvent traced = { event, threadId };
+                            this->trace.push_back(traced);
+                        }
+                }
+    };
+
+
+// The one profiler
+Profiler profiler;
+
+
+// RAII timers behind the macros
+class ProfileScope
+    {
+        public:
+            ProfileScope(const char* name) : name(name), start(profiler.Now()) {}
+            ~ProfileScope()
+                {
+                    ProfileEvent event = { this->name, this->start, profiler.Now() };
+                    profiler.ThreadRing().Push(event);
+                }
+
+        private:
+            const char* name;
+            long long start;
+    };
+
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if defined(DISABLE_PROFILER)
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#endif
@@ -0,0 +1,194 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+using namespace std;
+
+// Making the cache directory
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// GL Includes
+#include <GL/glew.h>
+
+
+// ====================================================================
+//  ProgramCache - linked shader programs saved to disk with
+//  glGetProgramBinary, so later launches can skip compiling and linking.
+//
+//  A program's key is a hash of its sources, its #defines and the
+//  driver's vendor/renderer/version strings, so editing a shader or
+//  updating the driver just misses the cache. A binary the driver turns
+//  down (it may refuse its own output after an update it doesn't report
+//  in the version string) is deleted, and the Shader compiles as usual.
+//
+//  Needs GL 4.1 / ARB_get_program_binary and at least one binary format;
+//  without them every lookup misses and nothing is written.
+// ====================================================================
+
+
+const char* const PROGRAM_CACHE_DIR = "shadercache";
+const unsigned int PROGRAM_CACHE_MAGIC = 0x42504C47;        // "GLPB"
+
+
+class ProgramCache
+    {
+        public:
+            // Stats
+            unsigned int Hits;          // Programs loaded from disk
+            unsigned int Misses;        // Programs that had to be compiled
+            unsigned int Rejected;      // Binaries on disk the driver wouldn't load
+
+            ProgramCache() : Hits(0), Misses(0), Rejected(0), checked(false), supported(false) {}
+
+            // Program binaries work on this context (needs a GL context)
+            bool Supported()
+                {
+                    if (!this->checked)
+                        {
+                            this->checked = true;
+                            GLint formats = 0;
+                            if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+                                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+                            this->supported = formats > 0;
+                            if (this->supported)
+                                {
+                                    this->driver = this->glString(GL_VENDOR) + "\n" + this->glString(GL_RENDERER) + "\n"
+                                                 + this->glString(GL_VERSION) + "\n";
+#ifdef _WIN32
+                                    _mkdir(PROGRAM_CACHE_DIR);
+#else
+                                    mkdir(PROGRAM_CACHE_DIR, 0755);
+#endif
+                                }
+                        }
+                    return this->supported;
+                }
+
+            // Key of a program built from `sources` (in stage order) with `defines`
+            unsigned long long Key(const vector<string>& sources, const string& defines = "")
+                {
+                    this->Supported();          // Fills in the driver strings
+                    unsigned long long hash = 14695981039346656037ULL;       // FNV-1a
+                    this->hash(hash, this->driver);
+                    this->hash(hash, defines);
+                    for (size_t i = 0; i < sources.size(); i++)
+                        {
+                            this->hash(hash, sources[i]);
+                            hash = (hash ^ 0xFF) * 1099511628211ULL;     // Stage separator, so text can't move between stages
+                        }
+                    return hash;
+                }
+
+            // Loads the binary saved under `key` into `program`; false (and a normal
+            // compile is needed) if there isn't one or the driver won't take it
+            bool Load(GLuint program, unsigned long long key)
+                {
+                    if (!this->Supported())
+                        {
+                            this->Misses++;
+                            return false;
+                        }
+
+                    string path = this->path(key);
+                    ifstream file(path.c_str(), ios::binary);
+                    unsigned int header[3] = { 0, 0, 0 };       // Magic, format, length
+                    vector<char> binary;
+                    if (file.read((char*)header, sizeof(header)) && header[0] == PROGRAM_CACHE_MAGIC && header[2] > 0)
+                        {
+                            binary.resize(header[2]);
+                            if (!file.read(&binary[0], binary.size()))
+                                binary.clear();
+                        }
+                    file.close();
+                    if (binary.empty())
+                        {
+                            this->Misses++;
+                            return false;
+                        }
+
+                    glProgramBinary(program, (GLenum)header[1], &binary[0], (GLsizei)binary.size());
+                    GLint linked = GL_FALSE;
+                    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+                    if (!linked)
+                        {
+                            remove(path.c_str());
+                            this->Rejected++;
+                            this->Misses++;
+                            return false;
+                        }
+                    this->Hits++;
+                    return true;
+                }
+
+            // Call before glLinkProgram on a program that will be Stored
+            void PrepareForStore(GLuint program)
+                {
+                    if (this->Supported())
+                        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+                }
+
+            // Saves a successfully linked `program` under `key`
+            void Store(GLuint program, unsigned long long key)
+                {
+                    if (!this->Supported())
+                        return;
+
+                    GLint length = 0;
+                    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+                    if (length <= 0)
+                        return;
+                    vector<char> binary(length);
+                    GLenum format = 0;
+                    glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+                    // Written to a temporary name first, so a crash never leaves half a binary under the real one
+                    string path = this->path(key), temporary = path + ".tmp";
+                    ofstream file(temporary.c_str(), ios::binary);
+                    unsigned int header[3] = { PROGRAM_CACHE_MAGIC, (unsigned int)format, (unsigned int)length };
+                    file.write((const char*)header, sizeof(header));
+                    file.write(&binary[0], length);
+                    file.close();
+                    if (!file)
+                        {
+                            remove(temporary.c_str());
+                            return;
+                        }
+                    remove(path.c_str());
+                    rename(temporary.c_str(), path.c_str());
+                }
+
+        private:
+            bool checked, supported;
+            string driver;              // Vendor, renderer and version, part of every key
+
+            string glString(GLenum name)
+                {
+                    const GLubyte* value = glGetString(name);
+                    return value ? string((const char*)value) : string();
+                }
+
+            void hash(unsigned long long& hash, const string& text)
+                {
+                    for (size_t i = 0; i < text.size(); i++)
+                        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+                }
+
+            string path(unsigned long long key)
+                {
+                    ostringstream name;
+                    name << PROGRAM_CACHE_DIR << "/" << hex << setw(16) << setfill('0') << key << ".bin";
+                    return name.str();
+                }
+    };
+
+
+// The cache every Shader goes through
+ProgramCache programCache;
@@ -0,0 +1,137 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+#include "mesh.h"
+#include "profiler.h"
+
+
+// ====================================================================
+//  RenderQueue - collects the frame's draws, sorts them so draws that
+//  share a program, textures and VAO end up next to each other, then
+//  issues them through the GL state cache (glstate.h).
+//
+//  The sort key packs, from most to least significant, 16 bits each of:
+//      program | first texture | VAO | submission order
+//  Program switches are the most expensive, so they are grouped first;
+//  the submission order keeps the sort stable for otherwise equal draws.
+//
+//  After sorting, runs of draws that share a program, textures, arena and
+//  instance buffer (or model matrix) are merged into one MultiDraw, so a
+//  whole model - or every model in a shared arena - goes out in one call.
+// ====================================================================
+
+
+struct DrawCommand
+    {
+        unsigned long long SortKey;
+        Shader*   Program;
+        Mesh*     Geometry;
+        GLint     ModelLocation;        // Where to put Model (-1 = instanced, no per-draw matrix)
+        glm::mat4 Model;
+        GLuint    InstanceBuffer;       // 0 = ordinary draw
+        GLintptr  InstanceOffset;       // Where the instances start in InstanceBuffer
+        GLsizei   InstanceCount;
+        int       Lod;                  // Level of detail of Geometry to draw
+    };
+
+
+// What the last Execute() did
+struct RenderQueueStats
+    {
+        unsigned int Draws;
+        unsigned int Batches;               // MultiDraw calls the draws were merged into
+        unsigned int StateChangesIssued;
+        unsigned int StateChangesSkipped;   // Redundant binds the state cache saved
+    };
+
+
+class RenderQueue
+    {
+        public:
+            RenderQueueStats Stats;
+
+            RenderQueue() { this->Stats = RenderQueueStats{ 0, 0, 0, 0 }; }
+
+            // Queues one draw of `mesh` with its own model matrix
+            void Submit(Shader& shader, Mesh& mesh, GLint modelLocation, const glm::mat4& model, int lod = 0)
+                {
+                    DrawCommand command = { makeKey(shader, mesh), &shader, &mesh, modelLocation, model, 0, 0, 1, lod };
+                    this->commands.push_back(command);
+                }
+
+            // Queues an instanced draw; the instance data must stay untouched until Execute()
+            void SubmitInstanced(Shader& shader, Mesh& mesh, GLuint instanceBuffer, GLsizei count, GLintptr offset = 0, int lod = 0)
+                {
+                    DrawCommand command = { makeKey(shader, mesh), &shader, &mesh, -1, glm::mat4(1), instanceBuffer, offset, count, lod };
+                    this->commands.push_back(command);
+                }
+
+            // Sorts and draws everything queued this frame, then empties the queue
+            void Execute()
+                {
+                    PROFILE_SCOPE("RenderQueue::Execute");
+                    sort(this->commands.begin(), this->commands.end(),
+                         [](const DrawCommand& a, const DrawCommand& b) { return a.SortKey < b.SortKey; });
+
+                    glState.ResetStats();
+                    this->Stats.Batches = 0;
+                    for (size_t first = 0; first < this->commands.size(); )
+                        {
+                            DrawCommand& command = this->commands[first];
+                            size_t last = first + 1;
+                            while (last < this->commands.size() && canMerge(command, this->commands[last]))
+                                last++;
+
+                            command.Program->Use();
+                            if (command.InstanceBuffer != 0)
+                                command.Geometry->Arena->BindInstances(command.InstanceBuffer, command.InstanceOffset);
+                            else
+                                command.Program->Set(command.ModelLocation, command.Model);
+                            command.Geometry->Bind(*command.Program);
+
+                            this->indirect.clear();
+                            for (size_t i = first; i < last; i++)
+                                this->indirect.push_back(GeometryArena::Command(this->commands[i].Geometry->LodRange(this->commands[i].Lod),
+                                                                                this->commands[i].InstanceCount));
+                            command.Geometry->Arena->MultiDraw(this->indirect);
+
+                            this->Stats.Batches++;
+                            first = last;
+                        }
+
+                    this->Stats.Draws = (unsigned int)this->commands.size();
+                    this->Stats.StateChangesIssued = glState.Issued;
+                    this->Stats.StateChangesSkipped = glState.Skipped;
+                    this->commands.clear();         // Keeps its capacity for next frame
+                }
+
+        private:
+            vector<DrawCommand> commands;
+            vector<DrawElementsIndirectCommand> indirect;
+
+            // Whether `b` can go out in the same MultiDraw as `a`
+            static bool canMerge(const DrawCommand& a, const DrawCommand& b)
+                {
+                    if (a.Program != b.Program || a.InstanceBuffer != b.InstanceBuffer || a.InstanceOffset != b.InstanceOffset ||
+                        !a.Geometry->SameTextures(*b.Geometry))
+                        return false;
+                    return a.InstanceBuffer != 0 || (a.ModelLocation == b.ModelLocation && a.Model == b.Model);
+                }
+
+            unsigned long long makeKey(Shader& shader, Mesh& mesh) const
+                {
+                    unsigned long long texture = mesh.textures.empty() ? 0 : mesh.textures[0].id;
+                    return ((unsigned long long)(shader.Program & 0xFFFF) << 48) |
+                           ((texture & 0xFFFF) << 32) |
+                           ((unsigned long long)(mesh.Arena->VAO & 0xFFFF) << 16) |
+                           (unsigned long long)(this->commands.size() & 0xFFFF);
+                }
+    };
@@ -0,0 +1,610 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+using namespace std;
+
+// Memory mapping
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ballsystem.h"
+#include "profiler.h"
+
+
+// ====================================================================
+//  Replay recording.
+//
+//  The physics thread calls ReplayRecorder::RecordTick() once per tick.
+//  That only copies the raw ball state into a lock-free single-producer/
+//  single-consumer ring buffer; a writer thread drains the ring and does
+//  all the real work, so recording never slows the simulation down. If
+//  the writer falls behind and the ring fills up, ticks are dropped (and
+//  counted) rather than blocking.
+//
+//  Two files are written:
+//      <name>.replay   a ReplayFileHeader with the tick rate the match was
+//                      played at, then every tick, positions and velocities quantized to
+//                      1/REPLAY_QUANT units and stored as varint deltas
+//                      from the previous tick, plus that tick's contacts
+//      <name>.snap     a full quantized state every REPLAY_SNAPSHOT_TICKS
+//                      ticks, with the offset of the next tick in .replay
+//
+//  ReplayReader memory-maps both files. Seeking finds the last snapshot
+//  at or before the wanted tick and decodes at most one snapshot
+//  interval of deltas from there, so jumping anywhere in a long match
+//  takes about a millisecond instead of re-simulating from the start.
+// ====================================================================
+
+
+// Default replay values
+const int    REPLAY_SNAPSHOT_TICKS  = 600;          // Ticks between snapshots (the file's TickRate says how long that is)
+const float  REPLAY_QUANT           = 256.0f;       // Steps per unit for positions and velocities
+const size_t REPLAY_RING_BYTES      = 1 << 22;      // 4 MB between the physics and writer threads
+const uint32_t REPLAY_MAGIC         = 0x32524250;   // "PBR2" (with the tick rate; "PBRP" files had none)
+const uint32_t SNAPSHOT_MAGIC       = 0x50414E53;   // "SNAP"
+
+
+// ====================================================================
+//  Lock-free single-producer/single-consumer byte ring.
+//  The producer reserves room for a whole record, Put()s its pieces and
+//  Commit()s; the consumer Get()s pieces and Release()s. Read and write
+//  positions only ever grow, and are masked into the buffer.
+// ====================================================================
+class SpscByteRing
+    {
+        public:
+            SpscByteRing(size_t capacity) : buffer(capacity), mask(capacity - 1), head(0), tail(0),
+                                            writePos(0), readPos(0)
+                {
+                    // capacity must be a power of two
+                }
+
+            // Producer: true if `bytes` fit right now
+            bool Reserve(size_t bytes)
+                {
+                    size_t used = this->tail.load(memory_order_relaxed) - this->head.load(memory_order_acquire);
+                    if (bytes > this->buffer.size() - used)
+                        return false;
+                    this->writePos = this->tail.load(memory_order_relaxed);
+                    return true;
+                }
+
+            void Put(const void* data, size_t bytes)
+                {
+                    copyIn(this->writePos, (const uint8_t*)data, bytes);
+                    this->writePos += bytes;
+                }
+
+            void Commit() { this->tail.store(this->writePos, memory_order_release); }
+
+            // Consumer: bytes committed and not yet released
+            size_t Available()
+                {
+                    this->readPos = this->head.load(memory_order_relaxed);
+                    return this->tail.load(memory_order_acquire) - this->readPos;
+                }
+
+            void Get(void* data, size_t bytes)
+                {
+                    copyOut(this->readPos, (uint8_t*)data, bytes);
+                    this->readPos += bytes;
+                }
+
+            void Release() { this->head.store(this->readPos, memory_order_release); }
+
+        private:
+            vector<uint8_t> buffer;
+            size_t mask;
+            atomic<size_t> head;        // Consumer position
+            atomic<size_t> tail;        // Producer position
+            size_t writePos;            // Producer's position inside the record being written
+            size_t readPos;             // Consumer's position inside the record being read
+
+            void copyIn(size_t pos, const uint8_t* src, size_t bytes)
+                {
+                    size_t at = pos & this->mask;
+                    size_t first = bytes < this->buffer.size() - at ? bytes : this->buffer.size() - at;
+                    memcpy(&this->buffer[at], src, first);
+                    if (bytes > first)
+                        memcpy(&this->buffer[0], src + first, bytes - first);
+                }
+
+            void copyOut(size_t pos, uint8_t* dst, size_t bytes)
+                {
+                    size_t at = pos & this->mask;
+                    size_t first = bytes < this->buffer.size() - at ? bytes : this->buffer.size() - at;
+                    memcpy(dst, &this->buffer[at], first);
+                    if (bytes > first)
+                        memcpy(dst + first, &this->buffer[0], bytes - first);
+                }
+    };
+
+
+
+// ====================================================================
+//  Varint helpers for the delta stream
+// ====================================================================
+
+inline void putVarint(vector<uint8_t>& out, uint64_t v)
+    {
+        while (v >= 0x80)
+            {
+                out.push_back((uint8_t)(v | 0x80));
+                v >>= 7;
+            }
+        out.push_back((uint8_t)v);
+    }
+
+inline uint64_t getVarint(const uint8_t*& p, const uint8_t* end)
+    {
+        uint64_t v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7)
+            {
+                uint8_t b = *p++;
+                v |= (uint64_t)(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    break;
+            }
+        return v;
+    }
+
+// Zig-zag maps small negative deltas to small unsigned numbers (0, -1, 1, -2 -> 0, 1, 2, 3)
+inline uint64_t zigzag(int64_t v)   { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t  unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+inline int32_t quantize(float v)    { return (int32_t)lrintf(v * REPLAY_QUANT); }
+inline float   dequantize(int32_t q) { return q / REPLAY_QUANT; }
+
+
+
+// Start of the .replay file
+struct ReplayFileHeader
+    {
+        uint32_t Magic;
+        uint32_t Quant;             // REPLAY_QUANT
+        double   TickRate;          // Ticks per second while recording
+    };
+
+// Header placed in the ring in front of each tick's raw data
+struct ReplayTickHeader
+    {
+        int64_t Tick;
+        int32_t BallCount;
+        int32_t ContactCount;
+    };
+
+// Header in front of each snapshot in the .snap file; followed by 4 * BallCount int32s
+struct ReplaySnapshotHeader
+    {
+        uint32_t Magic;
+        int32_t  BallCount;
+        int64_t  Tick;
+        uint64_t DeltaOffset;       // Where the tick after this one starts in .replay
+    };
+
+
+
+class ReplayRecorder
+    {
+        public:
+            long long TicksRecorded;
+            atomic<long long> TicksDropped;     // Ring was full
+
+            ReplayRecorder() : TicksRecorded(0), TicksDropped(0), ring(REPLAY_RING_BYTES), running(false),
+                               deltaFile(nullptr), snapFile(nullptr)
+                {
+                }
+
+            ~ReplayRecorder() { this->Stop(); }
+
+            // Opens <name>.replay and <name>.snap and starts the writer thread; `tickRate`
+            // is how many ticks a second RecordTick will be called for
+            bool Start(const string& name, double tickRate)
+                {
+                    this->Stop();
+                    this->deltaFile = fopen((name + ".replay").c_str(), "wb");
+                    this->snapFile = fopen((name + ".snap").c_str(), "wb");
+                    if (!this->deltaFile || !this->snapFile)
+                        {
+                            cout << "ERROR::REPLAY:: could not create " << name << ".replay/.snap" << endl;
+                            this->closeFiles();
+                            return false;
+                        }
+
+                    ReplayFileHeader header = { REPLAY_MAGIC, (uint32_t)REPLAY_QUANT, tickRate };
+                    fwrite(&header, sizeof(header), 1, this->deltaFile);
+                    this->deltaOffset = sizeof(header);
+
+                    this->TicksRecorded = 0;
+                    this->TicksDropped = 0;
+                    this->lastTick = -1;
+                    this->lastSnapshotTick = -1;
+                    this->prev.clear();
+                    this->running = true;
+                    this->writer = thread(&ReplayRecorder::writerLoop, this);
+                    return true;
+                }
+
+            // Drains whatever is still queued, then closes the files
+            void Stop()
+                {
+                    if (!this->running)
+                        return;
+                    this->running = false;
+                    this->writer.join();
+                    this->closeFiles();
+                }
+
+            bool IsRecording() const { return this->running; }
+
+            // Called from the physics loop after each tick; never blocks
+            void RecordTick(long long tick, const BallSystem& balls)
+                {
+                    if (!this->running)
+                        return;
+
+                    ReplayTickHeader header = { tick, balls.Count, (int32_t)balls.Contacts.size() };
+                    size_t floats = (size_t)balls.Count * sizeof(float);
+                    size_t bytes = sizeof(header) + 4 * floats + balls.Contacts.size() * sizeof(BallPair);
+                    if (!this->ring.Reserve(bytes))
+                        {
+                            this->TicksDropped++;
+                            return;
+                        }
+
+                    this->ring.Put(&header, sizeof(header));
+                    if (balls.Count > 0)
+                        {
+                            this->ring.Put(&balls.X[0], floats);
+                            this->ring.Put(&balls.Y[0], floats);
+                            this->ring.Put(&balls.VX[0], floats);
+                            this->ring.Put(&balls.VY[0], floats);
+                        }
+                    if (!balls.Contacts.empty())
+                        this->ring.Put(&balls.Contacts[0], balls.Contacts.size() * sizeof(BallPair));
+                    this->ring.Commit();
+                    this->TicksRecorded++;
+                }
+
+        private:
+            SpscByteRing ring;
+            atomic<bool> running;
+            thread writer;
+            FILE* deltaFile;
+            FILE* snapFile;
+
+            // Writer thread state
+            uint64_t deltaOffset;
+            long long lastTick, lastSnapshotTick;
+            vector<int32_t> prev, curr;         // Quantized x, y, vx, vy per ball
+            vector<float> raw;
+            vector<BallPair> contacts;
+            vector<uint8_t> frame;
+
+            void writerLoop()
+                {
+                    while (true)
+                        {
+                            bool stopping = !this->running;
+                            if (this->ring.Available() >= sizeof(ReplayTickHeader))
+                                {
+                                    this->writeTick();
+                                    continue;
+                                }
+                            if (stopping)
+                                break;
+                            this_thread::sleep_for(chrono::milliseconds(1));
+                        }
+                }
+
+            // Pulls one tick out of the ring and appends it to the files
+            void writeTick()
+                {
+                    PROFILE_SCOPE("Replay write");
+                    ReplayTickHeader header;
+                    this->ring.Get(&header, sizeof(header));
+                    int n = header.BallCount;
+                    this->raw.resize((size_t)n * 4);
+                    this->contacts.resize(header.ContactCount);
+                    if (n > 0)
+                        this->ring.Get(&this->raw[0], this->raw.size() * sizeof(float));
+                    if (header.ContactCount > 0)
+                        this->ring.Get(&this->contacts[0], this->contacts.size() * sizeof(BallPair));
+                    this->ring.Release();
+
+                    // Quantize, interleaved per ball: x, y, vx, vy
+                    this->curr.resize((size_t)n * 4);
+                    for (int i = 0; i < n; i++)
+                        for (int f = 0; f < 4; f++)
+                            this->curr[i * 4 + f] = quantize(this->raw[(size_t)f * n + i]);
+                    this->prev.resize(this->curr.size(), 0);
+
+                    // Delta frame
+                    this->frame.clear();
+                    putVarint(this->frame, (uint64_t)(header.Tick - this->lastTick));
+                    putVarint(this->frame, (uint64_t)n);
+                    putVarint(this->frame, (uint64_t)header.ContactCount);
+                    for (size_t k = 0; k < this->curr.size(); k++)
+                        putVarint(this->frame, zigzag((int64_t)this->curr[k] - this->prev[k]));
+                    for (size_t c = 0; c < this->contacts.size(); c++)
+                        {
+                            putVarint(this->frame, (uint64_t)this->contacts[c].A);
+                            putVarint(this->frame, (uint64_t)this->contacts[c].B);
+                        }
+                    fwrite(&this->frame[0], 1, this->frame.size(), this->deltaFile);
+                    this->deltaOffset += this->frame.size();
+
+                    // Full snapshot every so often
+                    if (this->lastSnapshotTick < 0 || header.Tick - this->lastSnapshotTick >= REPLAY_SNAPSHOT_TICKS)
+                        {
+                            ReplaySnapshotHeader snap = { SNAPSHOT_MAGIC, n, header.Tick, this->deltaOffset };
+                            fwrite(&snap, sizeof(snap), 1, this->snapFile);
+                            if (n > 0)
+                                fwrite(&this->curr[0], sizeof(int32_t), this->curr.size(), this->snapFile);
+                            this->lastSnapshotTick = header.Tick;
+                        }
+
+                    this->prev.swap(this->curr);
+                    this->lastTick = header.Tick;
+                }
+
+            void closeFiles()
+                {
+                    if (this->deltaFile)
+                        fclose(this->deltaFile);
+                    if (this->snapFile)
+                        fclose(this->snapFile);
+                    this->deltaFile = this->snapFile = nullptr;
+                }
+    };
+
+
+
+// ====================================================================
+//  Read-only memory-mapped file
+// ====================================================================
+class MappedFile
+    {
+        public:
+            const uint8_t* Data;
+            size_t Size;
+
+            MappedFile() : Data(nullptr), Size(0)
+#ifdef _WIN32
+                , file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#endif
+                {
+                }
+
+            ~MappedFile() { this->Close(); }
+
+            bool Open(const string& path)
+                {
+                    this->Close();
+#ifdef _WIN32
+                    this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                             FILE_ATTRIBUTE_NORMAL, nullptr);
+                    if (this->file == INVALID_HANDLE_VALUE)
+                        return false;
+                    LARGE_INTEGER size;
+                    GetFileSizeEx(this->file, &size);
+                    this->Size = (size_t)size.QuadPart;
+                    if (this->Size == 0)
+                        return true;
+                    this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                    if (!this->mapping)
+                        return false;
+                    this->Data = (const uint8_t*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+                    int fd = open(path.c_str(), O_RDONLY);
+                    if (fd < 0)
+                        return false;
+                    struct stat st;
+                    fstat(fd, &st);
+                    this->Size = (size_t)st.st_size;
+                    if (this->Size > 0)
+                        {
+                            void* p = mmap(nullptr, this->Size, PROT_READ, MAP_PRIVATE, fd, 0);
+                            this->Data = p == MAP_FAILED ? nullptr : (const uint8_t*)p;
+                        }
+                    close(fd);
+                    if (this->Size == 0)
+                        return true;
+#endif
+                    return this->Data != nullptr;
+                }
+
+            void Close()
+                {
+#ifdef _WIN32
+                    if (this->Data)
+                        UnmapViewOfFile(this->Data);
+                    if (this->mapping)
+                        CloseHandle(this->mapping);
+                    if (this->file != INVALID_HANDLE_VALUE)
+                        CloseHandle(this->file);
+                    this->mapping = nullptr;
+                    this->file = INVALID_HANDLE_VALUE;
+#else
+                    if (this->Data)
+                        munmap((void*)this->Data, this->Size);
+#endif
+                    this->Data = nullptr;
+                    this->Size = 0;
+                }
+
+        private:
+#ifdef _WIN32
+            HANDLE file, mapping;
+#endif
+    };
+
+
+
+// The state of the table at one recorded tick
+struct ReplayState
+    {
+        long long Tick;
+        vector<float> X, Y, VX, VY;
+        vector<BallPair> Contacts;
+
+        // Puts the recorded balls back onto a live table
+        void ApplyTo(BallSystem& balls) const
+            {
+                for (int i = 0; i < balls.Count && i < (int)this->X.size(); i++)
+                    {
+                        balls.X[i] = balls.PrevX[i] = this->X[i];
+                        balls.Y[i] = balls.PrevY[i] = this->Y[i];
+                        balls.VX[i] = this->VX[i];
+                        balls.VY[i] = this->VY[i];
+                    }
+            }
+    };
+
+
+class ReplayReader
+    {
+        public:
+            long long FirstTick, LastTick;
+            double TickRate;                // Ticks per second the recording was made at
+
+            ReplayReader() : FirstTick(-1), LastTick(-1), TickRate(0.0) {}
+
+            bool Open(const string& name)
+                {
+                    this->Close();
+                    if (!this->deltas.Open(name + ".replay") || !this->snaps.Open(name + ".snap") ||
+                        this->deltas.Size < sizeof(ReplayFileHeader) || *(const uint32_t*)this->deltas.Data != REPLAY_MAGIC)
+                        {
+                            cout << "ERROR::REPLAY:: could not open " << name << ".replay/.snap" << endl;
+                            return false;
+                        }
+
+                    // Index the snapshots - only their headers are touched
+                    size_t offset = 0;
+                    while (offset + sizeof(ReplaySnapshotHeader) <= this->snaps.Size)
+                        {
+                            const ReplaySnapshotHeader* header = (const ReplaySnapshotHeader*)(this->snaps.Data + offset);
+                            size_t bytes = sizeof(ReplaySnapshotHeader) + (size_t)header->BallCount * 4 * sizeof(int32_t);
+                            if (header->Magic != SNAPSHOT_MAGIC || offset + bytes > this->snaps.Size)
+                                break;
+                            this->snapshots.push_back(offset);
+                            offset += bytes;
+                        }
+                    if (this->snapshots.empty())
+                        return false;
+
+                    this->TickRate = ((const ReplayFileHeader*)this->deltas.Data)->TickRate;
+                    this->FirstTick = this->snapshot(0)->Tick;
+
+                    // The end of the recording is at most one snapshot interval past the last snapshot
+                    ReplayState state;
+                    this->Seek(0x7FFFFFFFFFFFFFFFLL, state);
+                    this->LastTick = state.Tick;
+                    return true;
+                }
+
+            // Unmaps both files; do this before recording over them
+            void Close()
+                {
+                    this->deltas.Close();
+                    this->snaps.Close();
+                    this->snapshots.clear();
+                    this->FirstTick = this->LastTick = -1;
+                    this->TickRate = 0.0;
+                }
+
+            // Fills `state` with the last recorded tick at or before `tick`
+            bool Seek(long long tick, ReplayState& state)
+                {
+                    if (this->snapshots.empty())
+                        return false;
+
+                    // Binary search for the last snapshot at or before the tick
+                    size_t lo = 0, hi = this->snapshots.size();
+                    while (hi - lo > 1)
+                        {
+                            size_t mid = (lo + hi) / 2;
+                            if (this->snapshot(mid)->Tick <= tick)
+                                lo = mid;
+                            else
+                                hi = mid;
+                        }
+                    const ReplaySnapshotHeader* snap = this->snapshot(lo);
+
+                    // Start from the snapshot...
+                    int n = snap->BallCount;
+                    const int32_t* values = (const int32_t*)(snap + 1);
+                    this->quant.assign(values, values + (size_t)n * 4);
+                    state.Tick = snap->Tick;
+                    state.Contacts.clear();
+
+                    // ...and roll the deltas forward up to the wanted tick
+                    const uint8_t* p = this->deltas.Data + snap->DeltaOffset;
+                    const uint8_t* end = this->deltas.Data + this->deltas.Size;
+                    while (p < end)
+                        {
+                            const uint8_t* frameStart = p;
+                            long long frameTick = state.Tick + (long long)getVarint(p, end);
+                            if (frameTick > tick)
+                                {
+                                    p = frameStart;
+                                    break;
+                                }
+
+                            int count = (int)getVarint(p, end);
+                            int contactCount = (int)getVarint(p, end);
+                            this->quant.resize((size_t)count * 4, 0);
+                            for (size_t k = 0; k < this->quant.size(); k++)
+                                this->quant[k] += (int32_t)unzigzag(getVarint(p, end));
+
+                            state.Contacts.resize(contactCount);
+                            for (int c = 0; c < contactCount; c++)
+                                {
+                                    state.Contacts[c].A = (int)getVarint(p, end);
+                                    state.Contacts[c].B = (int)getVarint(p, end);
+                                }
+                            state.Tick = frameTick;
+                        }
+
+                    // Unpack into floats
+                    n = (int)this->quant.size() / 4;
+                    state.X.resize(n);  state.Y.resize(n);
+                    state.VX.resize(n); state.VY.resize(n);
+                    for (int i = 0; i < n; i++)
+                        {
+                            state.X[i]  = dequantize(this->quant[i * 4 + 0]);
+                            state.Y[i]  = dequantize(this->quant[i * 4 + 1]);
+                            state.VX[i] = dequantize(this->quant[i * 4 + 2]);
+                            state.VY[i] = dequantize(this->quant[i * 4 + 3]);
+                        }
+                    return true;
+                }
+
+        private:
+            MappedFile deltas, snaps;
+            vector<size_t> snapshots;       // Offset of each snapshot in .snap
+            vector<int32_t> quant;
+
+            const ReplaySnapshotHeader* snapshot(size_t i) const
+                {
+                    return (const ReplaySnapshotHeader*)(this->snaps.Data + this->snapshots[i]);
+                }
+    };
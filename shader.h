@@ -7,14 +7,28 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "glstate.h"
+#include "programcache.h"
+
+// Uniform buffer binding point of the shared per-frame camera block (see frameuniforms.h)
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+
 
 class Shader
 {
 public:
     GLuint Program;
     
-    // Constructor generates the shader on the fly
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr)
+    // Constructor generates the shader on the fly. `defines` ("#define NAME\n" lines) go
+    // straight after each stage's #version line; see ShaderVariants below.
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr,
+           const std::string& defines = "")
     {
         // 1. Retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -45,18 +59,94 @@ public:
 				geometryCode = gShaderStream.str();
 			}
         }
-        catch (std::exception e)
+        catch (const std::exception&)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        // 2. Load the linked program from the binary cache, or compile and link it and save it there
+        std::vector<std::string> sources;
+        sources.push_back(vertexCode);
+        sources.push_back(fragmentCode);
+        sources.push_back(geometryCode);
+        unsigned long long cacheKey = programCache.Key(sources, defines);
+
+        this->Program = glCreateProgram();
+        if (!programCache.Load(this->Program, cacheKey))
+        {
+            if (!defines.empty())
+            {
+                vertexCode = injectDefines(vertexCode, defines);
+                fragmentCode = injectDefines(fragmentCode, defines);
+                geometryCode = injectDefines(geometryCode, defines);
+            }
+            this->compileAndLink(vertexCode, fragmentCode, geometryPath != nullptr ? &geometryCode : nullptr);
+
+            GLint linked = GL_FALSE;
+            glGetProgramiv(this->Program, GL_LINK_STATUS, &linked);
+            if (linked)
+                programCache.Store(this->Program, cacheKey);
+        }
+
+        // 3. Look up every active uniform once, so drawing never has to ask the driver
+        this->cacheUniforms();
+
+        // 4. Attach the shared per-frame block, if this program uses it
+        GLuint frameBlock = glGetUniformBlockIndex(this->Program, "FrameUniforms");
+        if (frameBlock != GL_INVALID_INDEX)
+            glUniformBlockBinding(this->Program, frameBlock, FRAME_UNIFORMS_BINDING);
+    }
+    
+    // Uses the current shader (skipped if it is already in use)
+    void Use() { glState.UseProgram(this->Program); }
+
+    // Location of a uniform, or -1 if the program doesn't use it. Resolve the
+    // locations you need once, outside the render loop, and pass them to Set().
+    GLint Uniform(const std::string& name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator it = this->uniforms.find(name);
+        return it != this->uniforms.end() ? it->second : -1;
+    }
+
+    // Typed uniform setters, by pre-resolved location (the program must be in use)
+    void Set(GLint location, GLint value) const              { glUniform1i(location, value); }
+    void Set(GLint location, GLfloat value) const            { glUniform1f(location, value); }
+    void Set(GLint location, const glm::vec2& value) const   { glUniform2fv(location, 1, glm::value_ptr(value)); }
+    void Set(GLint location, const glm::vec3& value) const   { glUniform3fv(location, 1, glm::value_ptr(value)); }
+    void Set(GLint location, const glm::vec4& value) const   { glUniform4fv(location, 1, glm::value_ptr(value)); }
+    void Set(GLint location, const glm::mat4& value) const   { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+
+    // ...and by name, for set-up code (one hash lookup, no driver round-trip)
+    template <typename T>
+    void Set(const std::string& name, const T& value) const  { this->Set(this->Uniform(name), value); }
+
+private:
+    std::unordered_map<std::string, GLint> uniforms;     // Active uniform name -> location
+
+    // Puts `defines` after the #version line (which has to come first), or at the top if there isn't one
+    static std::string injectDefines(const std::string& code, const std::string& defines)
+    {
+        size_t insertAt = 0;
+        size_t version = code.find("#version");
+        if (version != std::string::npos)
+        {
+            size_t lineEnd = code.find('\n', version);
+            insertAt = lineEnd != std::string::npos ? lineEnd + 1 : code.size();
+        }
+        std::string result = code.substr(0, insertAt);
+        if (insertAt > 0 && result[insertAt - 1] != '\n')
+            result += '\n';
+        result += defines;
+        result += insertAt > 0 ? "#line 2\n" : "#line 1\n";      // Keep compiler errors on the file's own line numbers
+        result += code.substr(insertAt);
+        return result;
+    }
+
+    // Compiles each stage and links them into Program
+    void compileAndLink(const std::string& vertexCode, const std::string& fragmentCode, const std::string* geometryCode)
+    {
         const GLchar* vShaderCode = vertexCode.c_str();
         const GLchar * fShaderCode = fragmentCode.c_str();
-        
-        
-        // 2. Compile shaders
         GLuint vertex, fragment;
-//        GLint success;
-//        GLchar infoLog[512];
         
         // Vertex Shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -68,40 +158,70 @@ public:
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
+        checkCompileErrors(fragment, "FRAGMENT");
         
-		// If geometry shader is given, compile geometry shader
-		GLuint geometry = 0;
-		if(geometryPath != nullptr)
-		{
-			const GLchar * gShaderCode = geometryCode.c_str();
-			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
-			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
-		}
+        // If geometry shader is given, compile geometry shader
+        GLuint geometry = 0;
+        if (geometryCode != nullptr)
+        {
+            const GLchar * gShaderCode = geometryCode->c_str();
+            geometry = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(geometry, 1, &gShaderCode, NULL);
+            glCompileShader(geometry);
+            checkCompileErrors(geometry, "GEOMETRY");
+        }
         
-        // Shader Program
-        this->Program = glCreateProgram();
+        // Shader Program (asking for a retrievable binary, for the cache)
         glAttachShader(this->Program, vertex);
         glAttachShader(this->Program, fragment);
-		if(geometryPath != nullptr)
-			glAttachShader(this->Program, geometry);
+        if (geometryCode != nullptr)
+            glAttachShader(this->Program, geometry);
+        programCache.PrepareForStore(this->Program);
         glLinkProgram(this->Program);
         checkCompileErrors(this->Program, "PROGRAM");
         
         // Delete the shaders as they're linked into our program now and no longer necessery
+        glDetachShader(this->Program, vertex);
+        glDetachShader(this->Program, fragment);
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-		if(geometryPath != nullptr)
-			glDeleteShader(geometry);
+        if (geometryCode != nullptr)
+        {
+            glDetachShader(this->Program, geometry);
+            glDeleteShader(geometry);
+        }
+    }
+
+    // Asks the linked program for all of its active uniforms (glGetActiveUniform)
+    void cacheUniforms()
+    {
+        this->uniforms.clear();
+
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::string name(maxLength > 0 ? maxLength : 1, '\0');
+
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(this->Program, (GLuint)i, maxLength, &length, &size, &type, &name[0]);
+            std::string uniformName(name.c_str(), length);
+
+            GLint location = glGetUniformLocation(this->Program, uniformName.c_str());
+            if (location < 0)
+                continue;       // Uniforms inside uniform blocks have no location
+            this->uniforms[uniformName] = location;
 
+            // Arrays are reported as "name[0]"; also file them under "name"
+            size_t bracket = uniformName.find("[0]");
+            if (bracket != std::string::npos)
+                this->uniforms[uniformName.substr(0, bracket)] = location;
+        }
     }
-    
-    // Uses the current shader
-    void Use() { glUseProgram(this->Program); }
 
-private:
     void checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
@@ -127,4 +247,77 @@ private:
 	}
 };
 
+
+
+// Shader features a program can be specialised for with #defines. Each bit
+// is the #define of the same index in SHADER_FEATURE_NAMES.
+enum ShaderFeature
+{
+    SHADER_INSTANCED        = 1 << 0,       // Per-instance model matrix and layer attributes
+    SHADER_PACKED_POSITIONS = 1 << 1,       // Positions decoded with vertexDecodeScale/Offset
+    SHADER_TEXTURE_ARRAY    = 1 << 2        // Diffuse from a layer of texture_diffuse_array (see texturearray.h)
+};
+
+// How many bits ShaderFeature has
+const int SHADER_FEATURE_COUNT = 3;
+
+const char* const SHADER_FEATURE_NAMES[SHADER_FEATURE_COUNT] = { "INSTANCED", "PACKED_POSITIONS", "TEXTURE_ARRAY" };
+
+
+// One set of shader files compiled as many ways as there are feature
+// combinations asked for: every variant is a separate program with the
+// unused paths #ifdef'd out, so nothing branches on a feature at run time.
+// A variant is compiled the first time it is asked for (or comes out of
+// the program binary cache) and kept for the rest of the run.
+class ShaderVariants
+{
+public:
+    ShaderVariants(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath != nullptr ? geometryPath : "")
+    {
+    }
+
+    ~ShaderVariants()
+    {
+        for (std::unordered_map<unsigned int, Shader*>::iterator it = this->variants.begin(); it != this->variants.end(); ++it)
+        {
+            glState.DeleteProgram(it->second->Program);
+            delete it->second;
+        }
+    }
+
+    // The program specialised for `features` (a mask of ShaderFeature bits)
+    Shader& Get(unsigned int features)
+    {
+        std::unordered_map<unsigned int, Shader*>::iterator it = this->variants.find(features);
+        if (it != this->variants.end())
+            return *it->second;
+
+        Shader* variant = new Shader(this->vertexPath.c_str(), this->fragmentPath.c_str(),
+                                     this->geometryPath.empty() ? nullptr : this->geometryPath.c_str(),
+                                     Defines(features));
+        this->variants[features] = variant;
+        return *variant;
+    }
+
+    // The #define lines for a feature mask
+    static std::string Defines(unsigned int features)
+    {
+        std::string defines;
+        for (int bit = 0; bit < SHADER_FEATURE_COUNT; bit++)
+            if (features & (1u << bit))
+                defines += std::string("#define ") + SHADER_FEATURE_NAMES[bit] + "\n";
+        return defines;
+    }
+
+    size_t VariantCount() const { return this->variants.size(); }
+
+private:
+    std::string vertexPath, fragmentPath, geometryPath;
+    std::unordered_map<unsigned int, Shader*> variants;
+
+    ShaderVariants(const ShaderVariants&);                  // Owns its programs: not copyable
+    ShaderVariants& operator=(const ShaderVariants&);
+};
+
 #endif
\ No newline at end of file
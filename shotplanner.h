@@ -0,0 +1,257 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <functional>
+using namespace std;
+
+#include "ballsystem.h"
+#include "ccd.h"
+#include "timestep.h"
+#include "threadpool.h"
+#include "profiler.h"
+
+
+// ====================================================================
+//  ShotPlanner - searches cue angle, power and spin for the best shot.
+//
+//  Every candidate shot is played out on a private copy of the table
+//  with the game's own physics - BallSystem::Step, or the event-driven
+//  simulator when the settings say the game is running it - at the
+//  game's tick rate, and scored on what ends up in the pockets. A shot
+//  the planner picks therefore plays out the same on the live table.
+//  Candidates are spread over a WorkStealingPool; each worker keeps one
+//  scratch table that is overwritten for every candidate, so once the
+//  scratch tables have grown to size evaluating a candidate allocates
+//  nothing.
+//
+//  Plan() blocks the calling thread, which works as the pool's worker 0.
+//  PlanAsync() does the same from a thread of its own, so the simulation
+//  can carry on ticking while a search runs.
+//
+//  The cue ball is always ball 0 (see SetupRack).
+// ====================================================================
+
+
+// Scoring
+const float SCORE_TARGET_POTTED = 100.0f;
+const float SCORE_OTHER_POTTED  = 10.0f;
+const float SCORE_SCRATCH       = -150.0f;     // Cue ball potted
+const float SCORE_NO_CONTACT    = -200.0f;     // Cue ball never touched another ball (foul)
+
+
+// One candidate shot
+struct ShotParams
+    {
+        float Angle;        // Direction of the cue ball in radians
+        float Power;        // Cue ball speed in units per second
+        float Spin;         // Follow (> 0) or draw (< 0), as a fraction of the speed at first contact
+    };
+
+
+// How a candidate shot played out
+struct ShotResult
+    {
+        ShotParams Shot;
+        float Score;
+        int   Potted;           // Object balls potted
+        bool  TargetPotted;
+        bool  Scratch;
+        bool  CutOff;           // Abandoned early as hopeless
+        int   Ticks;            // Physics ticks simulated
+    };
+
+
+// What to search, and how hard
+struct ShotSearchSettings
+    {
+        int   AngleSteps, PowerSteps, SpinSteps;
+        float MinPower, MaxPower;
+        float MaxSpin;
+        int   TargetBall;           // Ball we want potted (-1 = any object ball)
+        float HorizonSeconds;       // How long each shot is played out for
+        float ContactDeadline;      // Cut a shot off if the cue ball has touched nothing by then
+        float TickRate;             // Set both of these to match the game's physics
+        bool  UseCCD;
+
+        ShotSearchSettings() : AngleSteps(360), PowerSteps(8), SpinSteps(3), MinPower(60.0f), MaxPower(480.0f),
+                               MaxSpin(0.5f), TargetBall(-1), HorizonSeconds(4.0f), ContactDeadline(1.5f),
+                               TickRate((float)PHYSICS_HZ), UseCCD(false)
+            {
+            }
+
+        int CandidateCount() const { return this->AngleSteps * this->PowerSteps * this->SpinSteps; }
+
+        // The i-th candidate of the search grid
+        ShotParams Candidate(int i) const
+            {
+                int a = i % this->AngleSteps;
+                int p = (i / this->AngleSteps) % this->PowerSteps;
+                int s = i / (this->AngleSteps * this->PowerSteps);
+
+                ShotParams shot;
+                shot.Angle = 6.2831853f * a / this->AngleSteps;
+                shot.Power = this->PowerSteps > 1 ? this->MinPower + (this->MaxPower - this->MinPower) * p / (this->PowerSteps - 1)
+                                                  : this->MaxPower;
+                shot.Spin = this->SpinSteps > 1 ? -this->MaxSpin + 2.0f * this->MaxSpin * s / (this->SpinSteps - 1) : 0.0f;
+                return shot;
+            }
+    };
+
+
+class ShotPlanner
+    {
+        public:
+            WorkStealingPool Pool;
+            long long CandidatesEvaluated;
+            long long CandidatesCutOff;
+
+            ShotPlanner(int threads = 0) : Pool(threads), CandidatesEvaluated(0), CandidatesCutOff(0), planning(false)
+                {
+                    this->scratch.resize(this->Pool.ThreadCount());
+                    this->scratchCCD.resize(this->Pool.ThreadCount());
+                }
+
+            ~ShotPlanner()
+                {
+                    if (this->planThread.joinable())
+                        this->planThread.join();
+                }
+
+            // Runs Plan on a copy of `table` without blocking, then calls `done` with the
+            // best shots - on the planning thread. Returns false if a search is already running.
+            bool PlanAsync(const BallSystem& table, const ShotSearchSettings& settings, int count,
+                           function<void(const vector<ShotResult>&)> done)
+                {
+                    if (this->planning.exchange(true))
+                        return false;
+                    if (this->planThread.joinable())
+                        this->planThread.join();            // Finished: it cleared `planning`
+
+                    this->planThread = thread([this, table, settings, count, done]()
+                        {
+                            vector<ShotResult> best = this->Plan(table, settings, count);
+                            done(best);
+                            this->planning = false;
+                        });
+                    return true;
+                }
+
+            bool IsPlanning() const { return this->planning; }
+
+            // Plays out every candidate shot from `table` and returns the best `count`, best first
+            vector<ShotResult> Plan(const BallSystem& table, const ShotSearchSettings& settings, int count = 5)
+                {
+                    PROFILE_SCOPE("ShotPlanner::Plan");
+                    int candidates = settings.CandidateCount();
+                    this->results.resize(candidates);
+
+                    this->Pool.ParallelFor(candidates, 16, [&](int i, int worker)
+                        {
+                            this->results[i] = this->Evaluate(table, settings.Candidate(i), settings, this->scratch[worker],
+                                                              this->scratchCCD[worker]);
+                        });
+
+                    for (int i = 0; i < candidates; i++)
+                        {
+                            this->CandidatesEvaluated++;
+                            if (this->results[i].CutOff)
+                                this->CandidatesCutOff++;
+                        }
+
+                    if (count > candidates)
+                        count = candidates;
+                    partial_sort(this->results.begin(), this->results.begin() + count, this->results.end(),
+                                 [](const ShotResult& a, const ShotResult& b) { return a.Score > b.Score; });
+                    return vector<ShotResult>(this->results.begin(), this->results.begin() + count);
+                }
+
+            // Plays out one shot on `balls` (overwritten with a copy of `table`) and scores it;
+            // `ccd` is only used with settings.UseCCD
+            static ShotResult Evaluate(const BallSystem& table, const ShotParams& shot,
+                                       const ShotSearchSettings& settings, BallSystem& balls, EventDrivenSimulator& ccd)
+                {
+                    balls = table;      // Reuses the scratch table's memory
+
+                    ShotResult result = { shot, 0.0f, 0, false, false, false, 0 };
+                    balls.Strike(shot.Angle, shot.Power, shot.Spin);
+                    ccd.Reset();
+
+                    float dt = 1.0f / settings.TickRate;
+                    int horizon = (int)(settings.HorizonSeconds * settings.TickRate);
+                    int deadline = (int)(settings.ContactDeadline * settings.TickRate);
+                    bool touched = false;
+
+                    for (int tick = 0; tick < horizon; tick++)
+                        {
+                            // Exactly what the game runs for a tick
+                            if (settings.UseCCD)
+                                ccd.Step(balls, dt);
+                            else
+                                balls.Step(dt);
+                            result.Ticks = tick + 1;
+
+                            for (size_t c = 0; c < balls.Contacts.size(); c++)
+                                if (balls.Contacts[c].A == 0 || balls.Contacts[c].B == 0)
+                                    touched = true;
+
+                            for (size_t p = 0; p < balls.Potted.size(); p++)
+                                {
+                                    int b = balls.Potted[p];
+                                    if (b == 0)
+                                        result.Scratch = true;
+                                    else if (b == settings.TargetBall)
+                                        result.TargetPotted = true;
+                                    else
+                                        result.Potted++;
+                                }
+
+                            // Hopeless: scratched before touching anything, or nothing touched in time
+                            if (!touched && (result.Scratch || tick >= deadline))
+                                {
+                                    result.CutOff = true;
+                                    break;
+                                }
+                        }
+
+                    result.Score = score(result, balls, settings, touched);
+                    return result;
+                }
+
+        private:
+            vector<BallSystem> scratch;     // One table per worker
+            vector<EventDrivenSimulator> scratchCCD;
+            vector<ShotResult> results;
+            atomic<bool> planning;          // PlanAsync's search is running
+            thread planThread;
+
+            static float score(const ShotResult& result, const BallSystem& balls,
+                               const ShotSearchSettings& settings, bool touched)
+                {
+                    if (!touched)
+                        return SCORE_NO_CONTACT;
+
+                    float score = SCORE_OTHER_POTTED * result.Potted;
+                    if (result.TargetPotted || (settings.TargetBall < 0 && result.Potted > 0))
+                        score += SCORE_TARGET_POTTED;
+                    if (result.Scratch)
+                        score += SCORE_SCRATCH;
+
+                    // Tie-break: the target ball left close to a pocket is better than far away
+                    int target = settings.TargetBall;
+                    if (target > 0 && target < balls.Count && !result.TargetPotted)
+                        {
+                            float nearest = 1.0e9f;
+                            for (int p = 0; p < POCKET_COUNT; p++)
+                                {
+                                    float dx = balls.X[target] - balls.PocketX(p), dy = balls.Y[target] - balls.PocketY(p);
+                                    nearest = fminf(nearest, dx * dx + dy * dy);
+                                }
+                            score -= sqrt(nearest) / 100.0f;
+                        }
+                    return score;
+                }
+    };
@@ -0,0 +1,345 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+
+// ====================================================================
+//  Mesh simplification by quadric-error edge collapse (Garland and
+//  Heckbert), used to build the LOD chain of every loaded Mesh.
+//
+//  Only indices change: each collapse moves one corner onto a vertex
+//  that already exists, so every LOD indexes the mesh's own vertex
+//  buffer and the LODs can share it in the arena.
+//
+//  Assimp hands us a separate vertex per triangle corner unless asked to
+//  join them, so the simplifier works on positions: vertices at the same
+//  spot form one position and collapse together. Positions whose
+//  vertices disagree on normal or UV (texture seams, hard edges) and
+//  positions on an open border are never moved, which keeps seams shut.
+// ====================================================================
+
+
+const int   LOD_MAX_LEVELS      = 4;        // Including the full mesh
+const float LOD_REDUCTION       = 0.5f;     // Each level keeps about this fraction of the triangles
+const int   LOD_MIN_TRIANGLES   = 32;       // No point simplifying below this
+
+// Selection (Model::SelectLod): use the coarsest level whose error covers
+// less than LOD_PIXEL_ERROR pixels on screen. Going coarser needs the error
+// to drop a further LOD_HYSTERESIS below that, so instances near the
+// threshold don't flicker between levels.
+const float LOD_PIXEL_ERROR     = 1.0f;
+const float LOD_HYSTERESIS      = 0.75f;
+
+
+// One simplified level
+struct SimplifiedLevel
+    {
+        vector<GLuint> Indices;
+        GLfloat Error;          // Roughly the furthest any surface moved, in model units
+    };
+
+
+// Symmetric 4x4 error quadric, stored as its 10 distinct entries
+struct Quadric
+    {
+        double A[10];
+
+        Quadric() { memset(this->A, 0, sizeof(this->A)); }
+
+        // Squared distance to the plane ax + by + cz + d = 0 (unit normal)
+        static Quadric FromPlane(double a, double b, double c, double d)
+            {
+                Quadric q;
+                q.A[0] = a * a; q.A[1] = a * b; q.A[2] = a * c; q.A[3] = a * d;
+                q.A[4] = b * b; q.A[5] = b * c; q.A[6] = b * d;
+                q.A[7] = c * c; q.A[8] = c * d;
+                q.A[9] = d * d;
+                return q;
+            }
+
+        void Add(const Quadric& other)
+            {
+                for (int i = 0; i < 10; i++)
+                    this->A[i] += other.A[i];
+            }
+
+        double Error(double x, double y, double z) const
+            {
+                const double* a = this->A;
+                return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+                     + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+                     + a[7] * z * z + 2 * a[8] * z
+                     + a[9];
+            }
+    };
+
+
+// Simplifies a triangle list down through LOD_MAX_LEVELS - 1 coarser levels. Stops
+// early if the mesh gets too small or nothing more can be collapsed.
+template <typename VertexT>
+vector<SimplifiedLevel> BuildLodChain(const vector<VertexT>& vertices, const vector<GLuint>& indices)
+    {
+        vector<SimplifiedLevel> levels;
+        int vertexCount = (int)vertices.size();
+        int triangleCount = (int)indices.size() / 3;
+        if (triangleCount < LOD_MIN_TRIANGLES * 2)
+            return levels;
+
+        // Weld vertices that share a position
+        vector<int> positionOf(vertexCount);
+        vector<int> positionVertex;                 // One vertex of each position
+        unordered_map<unsigned long long, int> weld;
+        for (int v = 0; v < vertexCount; v++)
+            {
+                unsigned int x, y, z;
+                memcpy(&x, &vertices[v].Position.x, 4);
+                memcpy(&y, &vertices[v].Position.y, 4);
+                memcpy(&z, &vertices[v].Position.z, 4);
+                unsigned long long key = ((unsigned long long)x * 73856093ULL) ^ ((unsigned long long)y * 19349663ULL << 16) ^
+                                         ((unsigned long long)z * 83492791ULL << 32);
+                unordered_map<unsigned long long, int>::iterator it = weld.find(key);
+                if (it != weld.end() && !(vertices[positionVertex[it->second]].Position == vertices[v].Position))
+                    it = weld.end();        // Hash collision - treat as a new position
+                if (it == weld.end())
+                    {
+                        int p = (int)positionVertex.size();
+                        positionVertex.push_back(v);
+                        weld[key] = p;
+                        positionOf[v] = p;
+                    }
+                else
+                    positionOf[v] = it->second;
+            }
+        int positionCount = (int)positionVertex.size();
+
+        // Positions whose vertices disagree on normal/UV are locked
+        vector<unsigned char> locked(positionCount, 0);
+        vector<vector<int> > wedges(positionCount);
+        for (int v = 0; v < vertexCount; v++)
+            {
+                int p = positionOf[v];
+                const VertexT& first = vertices[positionVertex[p]];
+                if (glm::dot(first.Normal, vertices[v].Normal) < 0.999f ||
+                    glm::length(first.TexCoords - vertices[v].TexCoords) > 1.0e-4f)
+                    locked[p] = 1;
+                wedges[p].push_back(v);
+            }
+
+        // Triangles, in positions and corners, plus an edge count to find open borders
+        vector<GLuint> corner(indices.begin(), indices.end());
+        vector<int> tri(triangleCount * 3);
+        vector<unsigned char> alive(triangleCount, 1);
+        vector<vector<int> > trianglesOf(positionCount);
+        unordered_map<unsigned long long, int> edgeUse;
+        int aliveCount = 0;
+        for (int t = 0; t < triangleCount; t++)
+            {
+                for (int k = 0; k < 3; k++)
+                    tri[t * 3 + k] = positionOf[corner[t * 3 + k]];
+                int a = tri[t * 3], b = tri[t * 3 + 1], c = tri[t * 3 + 2];
+                if (a == b || b == c || a == c)
+                    {
+                        alive[t] = 0;
+                        continue;
+                    }
+                aliveCount++;
+                for (int k = 0; k < 3; k++)
+                    {
+                        int p = tri[t * 3 + k], q = tri[t * 3 + (k + 1) % 3];
+                        trianglesOf[p].push_back(t);
+                        unsigned long long edge = p < q ? ((unsigned long long)p << 32) | q : ((unsigned long long)q << 32) | p;
+                        edgeUse[edge]++;
+                    }
+            }
+        for (unordered_map<unsigned long long, int>::iterator it = edgeUse.begin(); it != edgeUse.end(); ++it)
+            if (it->second == 1)
+                locked[it->first >> 32] = locked[it->first & 0xFFFFFFFFULL] = 1;
+
+        // Every position starts with the planes of its triangles
+        vector<Quadric> quadric(positionCount);
+        for (int t = 0; t < triangleCount; t++)
+            {
+                if (!alive[t])
+                    continue;
+                const glm::vec3& p0 = vertices[positionVertex[tri[t * 3]]].Position;
+                const glm::vec3& p1 = vertices[positionVertex[tri[t * 3 + 1]]].Position;
+                const glm::vec3& p2 = vertices[positionVertex[tri[t * 3 + 2]]].Position;
+                glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                float length = glm::length(n);
+                if (length == 0.0f)
+                    continue;
+                n /= length;
+                Quadric plane = Quadric::FromPlane(n.x, n.y, n.z, -glm::dot(n, p0));
+                for (int k = 0; k < 3; k++)
+                    quadric[tri[t * 3 + k]].Add(plane);
+            }
+
+        // Cheapest collapse of each position, kept in a heap; stale entries are skipped by stamp
+        struct Collapse
+            {
+                double Cost;
+                int From, To;
+                unsigned int Stamp;
+                bool operator<(const Collapse& other) const { return this->Cost > other.Cost; }
+            };
+        priority_queue<Collapse> heap;
+        vector<unsigned int> stamp(positionCount, 0);
+        vector<unsigned char> dead(positionCount, 0);
+
+        // Moving `from` onto `to` must not flip or flatten any triangle that survives
+        auto flips = [&](int from, int to) -> bool
+            {
+                const glm::vec3& target = vertices[positionVertex[to]].Position;
+                for (size_t i = 0; i < trianglesOf[from].size(); i++)
+                    {
+                        int t = trianglesOf[from][i];
+                        if (!alive[t] || tri[t * 3] == to || tri[t * 3 + 1] == to || tri[t * 3 + 2] == to)
+                            continue;
+                        glm::vec3 p[3], moved[3];
+                        for (int k = 0; k < 3; k++)
+                            {
+                                p[k] = vertices[positionVertex[tri[t * 3 + k]]].Position;
+                                moved[k] = tri[t * 3 + k] == from ? target : p[k];
+                            }
+                        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                        glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                        float afterLength = glm::length(after);
+                        if (afterLength == 0.0f || glm::dot(before, after) < 0.2f * glm::length(before) * afterLength)
+                            return true;
+                    }
+                return false;
+            };
+
+        auto pushBest = [&](int from)
+            {
+                stamp[from]++;
+                if (locked[from] || dead[from])
+                    return;
+
+                Collapse best = { 1.0e300, from, -1, stamp[from] };
+                for (size_t i = 0; i < trianglesOf[from].size(); i++)
+                    {
+                        int t = trianglesOf[from][i];
+                        if (!alive[t])
+                            continue;
+                        for (int k = 0; k < 3; k++)
+                            {
+                                int to = tri[t * 3 + k];
+                                if (to == from)
+                                    continue;
+                                const glm::vec3& target = vertices[positionVertex[to]].Position;
+                                Quadric q = quadric[from];
+                                q.Add(quadric[to]);
+                                double cost = q.Error(target.x, target.y, target.z);
+                                if (cost < best.Cost && !flips(from, to))
+                                    {
+                                        best.Cost = cost;
+                                        best.To = to;
+                                    }
+                            }
+                    }
+                if (best.To >= 0)
+                    heap.push(best);
+            };
+
+        for (int p = 0; p < positionCount; p++)
+            pushBest(p);
+
+        // Replacement for vertex v (at `from`) among the vertices at `to`: the one that looks most like it
+        auto closestWedge = [&](int v, int to) -> int
+            {
+                int best = wedges[to][0];
+                float bestDistance = 1.0e30f;
+                for (size_t i = 0; i < wedges[to].size(); i++)
+                    {
+                        int w = wedges[to][i];
+                        float distance = glm::length(vertices[w].TexCoords - vertices[v].TexCoords) +
+                                         (1.0f - glm::dot(vertices[w].Normal, vertices[v].Normal));
+                        if (distance < bestDistance)
+                            {
+                                bestDistance = distance;
+                                best = w;
+                            }
+                    }
+                return best;
+            };
+
+        double maxError = 0.0;
+        int target = (int)(aliveCount * LOD_REDUCTION);
+        vector<int> touched;
+        while (!heap.empty() && (int)levels.size() < LOD_MAX_LEVELS - 1 && target >= LOD_MIN_TRIANGLES)
+            {
+                Collapse collapse = heap.top();
+                heap.pop();
+                int from = collapse.From, to = collapse.To;
+                if (dead[from] || collapse.Stamp != stamp[from])
+                    continue;
+                if (dead[to])
+                    {
+                        pushBest(from);
+                        continue;
+                    }
+
+                // Collapse: triangles on the edge go, the rest move their corner onto `to`
+                for (size_t i = 0; i < trianglesOf[from].size(); i++)
+                    {
+                        int t = trianglesOf[from][i];
+                        if (!alive[t])
+                            continue;
+                        if (tri[t * 3] == to || tri[t * 3 + 1] == to || tri[t * 3 + 2] == to)
+                            {
+                                alive[t] = 0;
+                                aliveCount--;
+                                continue;
+                            }
+                        for (int k = 0; k < 3; k++)
+                            if (tri[t * 3 + k] == from)
+                                {
+                                    tri[t * 3 + k] = to;
+                                    corner[t * 3 + k] = closestWedge(corner[t * 3 + k], to);
+                                }
+                        trianglesOf[to].push_back(t);
+                    }
+                quadric[to].Add(quadric[from]);
+                dead[from] = 1;
+                trianglesOf[from].clear();
+                maxError = fmax(maxError, collapse.Cost);
+
+                // `to` and everything around it now has different collapses available
+                touched.clear();
+                touched.push_back(to);
+                for (size_t i = 0; i < trianglesOf[to].size(); i++)
+                    {
+                        int t = trianglesOf[to][i];
+                        if (alive[t])
+                            for (int k = 0; k < 3; k++)
+                                if (tri[t * 3 + k] != to)
+                                    touched.push_back(tri[t * 3 + k]);
+                    }
+                for (size_t i = 0; i < touched.size(); i++)
+                    pushBest(touched[i]);
+
+                // Snapshot a level every time we get down to the next target
+                if (aliveCount <= target)
+                    {
+                        SimplifiedLevel level;
+                        level.Error = (GLfloat)sqrt(maxError);
+                        for (int t = 0; t < triangleCount; t++)
+                            if (alive[t])
+                                level.Indices.insert(level.Indices.end(), &corner[t * 3], &corner[t * 3] + 3);
+                        levels.push_back(level);
+                        target = (int)(aliveCount * LOD_REDUCTION);
+                    }
+            }
+
+        return levels;
+    }
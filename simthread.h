@@ -0,0 +1,189 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+using namespace std;
+
+#include "ballsystem.h"
+#include "profiler.h"
+
+
+// ====================================================================
+//  Simulation thread - physics runs on its own thread, apart from input
+//  handling and GL submission on the main thread.
+//
+//  After each batch of ticks the simulation fills in a SceneSnapshot and
+//  publishes it through a TripleBuffer: one copy being written, one
+//  waiting, one being drawn. Publishing and picking up the newest
+//  snapshot are each a single atomic exchange, so neither side ever
+//  waits for the other - a slow GPU frame doesn't hold up physics, and
+//  a physics spike just means the renderer draws the previous snapshot
+//  again.
+//
+//  Anything else that changes simulation state (keys that shoot, seek a
+//  replay or switch physics mode) is Post()ed as a command and run on
+//  the simulation thread between ticks.
+// ====================================================================
+
+
+const double SIM_THREAD_MAX_SLEEP = 0.002;      // Longest nap between updates, in seconds
+
+
+// Lock-free single-producer/single-consumer triple buffer. The writer fills
+// Write() and Publish()es it; the reader calls Update() and draws Read().
+template <typename T>
+class TripleBuffer
+    {
+        public:
+            TripleBuffer() : middle(1), writeIndex(0), readIndex(2) {}
+
+            // Writer side
+            T& Write() { return this->buffers[this->writeIndex]; }
+
+            void Publish()
+                {
+                    unsigned int previous = this->middle.exchange(this->writeIndex | FRESH, memory_order_acq_rel);
+                    this->writeIndex = previous & INDEX;
+                }
+
+            // Reader side: swaps in the newest published copy, if there is one since the last Update
+            bool Update()
+                {
+                    if ((this->middle.load(memory_order_relaxed) & FRESH) == 0)
+                        return false;
+                    unsigned int previous = this->middle.exchange(this->readIndex, memory_order_acq_rel);
+                    this->readIndex = previous & INDEX;
+                    return true;
+                }
+
+            const T& Read() const { return this->buffers[this->readIndex]; }
+
+        private:
+            static const unsigned int INDEX = 3;
+            static const unsigned int FRESH = 4;    // Middle holds a copy the reader hasn't taken
+
+            T buffers[3];
+            atomic<unsigned int> middle;            // Index of the waiting copy, plus FRESH
+            unsigned int writeIndex;                // Only touched by the writer
+            unsigned int readIndex;                 // Only touched by the reader
+    };
+
+
+// What the renderer needs from one moment of the simulation. Same
+// interpolation interface as BallSystem, so drawing code reads it the same way.
+struct SceneSnapshot
+    {
+        long long Tick;                 // Ticks simulated so far
+        double TickTime;                // Clock time the last tick stands for
+        double Dt;                      // Seconds per tick
+        int Count;
+        vector<float> X, Y, PrevX, PrevY, Angle, PrevAngle, VX, VY, Radius;
+
+        SceneSnapshot() : Tick(0), TickTime(0.0), Dt(1.0), Count(0) {}
+
+        void CopyFrom(const BallSystem& balls)
+            {
+                this->Count = balls.Count;
+                this->X.assign(balls.X.begin(), balls.X.begin() + balls.Count);
+                this->Y.assign(balls.Y.begin(), balls.Y.begin() + balls.Count);
+                this->PrevX.assign(balls.PrevX.begin(), balls.PrevX.begin() + balls.Count);
+                this->PrevY.assign(balls.PrevY.begin(), balls.PrevY.begin() + balls.Count);
+                this->Angle.assign(balls.Angle.begin(), balls.Angle.begin() + balls.Count);
+                this->PrevAngle.assign(balls.PrevAngle.begin(), balls.PrevAngle.begin() + balls.Count);
+                this->VX.assign(balls.VX.begin(), balls.VX.begin() + balls.Count);
+                this->VY.assign(balls.VY.begin(), balls.VY.begin() + balls.Count);
+                this->Radius.assign(balls.Radius.begin(), balls.Radius.begin() + balls.Count);
+            }
+
+        // How far `now` is from the last tick towards the next, from 0 to 1
+        float Alpha(double now) const
+            {
+                return (float)min(1.0, max(0.0, (now - this->TickTime) / this->Dt));
+            }
+
+        float InterpolatedX(int i, float alpha) const { return this->PrevX[i] + (this->X[i] - this->PrevX[i]) * alpha; }
+        float InterpolatedY(int i, float alpha) const { return this->PrevY[i] + (this->Y[i] - this->PrevY[i]) * alpha; }
+        float InterpolatedAngle(int i, float alpha) const { return this->PrevAngle[i] + (this->Angle[i] - this->PrevAngle[i]) * alpha; }
+    };
+
+
+class SimulationThread
+    {
+        public:
+            TripleBuffer<SceneSnapshot> Snapshots;
+
+            SimulationThread() : running(false) {}
+            ~SimulationThread() { this->Stop(); }
+
+            // Calls `update(clock())` over and over on a new thread. `update` runs whatever
+            // is due and returns the seconds until it next has work.
+            void Start(function<double(double)> update, function<double()> clock)
+                {
+                    this->Stop();
+                    this->update = update;
+                    this->clock = clock;
+                    this->running = true;
+                    this->worker = thread(&SimulationThread::loop, this);
+                }
+
+            void Stop()
+                {
+                    if (!this->running)
+                        return;
+                    this->running = false;
+                    this->worker.join();
+                    this->RunCommands();
+                }
+
+            bool IsRunning() const { return this->running; }
+
+            // Queues `command` to run on the simulation thread before its next update
+            // (or on the next RunCommands when no thread is running)
+            void Post(function<void()> command)
+                {
+                    lock_guard<mutex> lock(this->commandsLock);
+                    this->commands.push_back(command);
+                }
+
+            // Runs every queued command; the thread does this itself, single-threaded runs call it
+            void RunCommands()
+                {
+                    {
+                        lock_guard<mutex> lock(this->commandsLock);
+                        this->runningCommands.swap(this->commands);
+                    }
+                    for (size_t i = 0; i < this->runningCommands.size(); i++)
+                        this->runningCommands[i]();
+                    this->runningCommands.clear();
+                }
+
+        private:
+            atomic<bool> running;
+            thread worker;
+            function<double(double)> update;
+            function<double()> clock;
+
+            mutex commandsLock;                         // Held only to add or swap out the list
+            vector<function<void()> > commands;
+            vector<function<void()> > runningCommands;
+
+            void loop()
+                {
+                    while (this->running)
+                        {
+                            this->RunCommands();
+                            double wait;
+                            {
+                                PROFILE_SCOPE("Simulation update");
+                                wait = this->update(this->clock());
+                            }
+                            if (wait > 0.0)
+                                this_thread::sleep_for(chrono::duration<double>(min(wait, SIM_THREAD_MAX_SLEEP)));
+                        }
+                }
+    };
@@ -0,0 +1,166 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cmath>
+using namespace std;
+
+
+// ====================================================================
+//  SpatialGrid - broad phase for ball-ball collisions.
+//
+//  The table is cut into square cells at least one ball diameter wide,
+//  so two balls can only touch if they sit in the same or neighbouring
+//  cells. Each tick only the balls that changed cell are moved between
+//  cell lists, and FindCandidatePairs() walks every cell against itself
+//  and four of its neighbours (right, and the three below) so each pair
+//  of cells - and so each pair of balls - is visited exactly once.
+//
+//  Cell lists keep their capacity between ticks, so once the grid has
+//  warmed up a tick allocates nothing.
+// ====================================================================
+
+
+// A pair of ball indices that might be touching (A < B is not guaranteed)
+struct BallPair
+    {
+        int A, B;
+    };
+
+
+class SpatialGrid
+    {
+        public:
+            //  Grid Data
+            float CellSize;
+            float OriginX, OriginY;         // Lower-left corner of cell (0, 0)
+            int Cols, Rows;
+            vector< vector<int> > Cells;    // Ball indices in each cell
+            vector<int> BallCell;           // Cell each ball is filed under
+            vector<int> BallSlot;           // Position of each ball inside its cell list
+            int BallCount;
+
+            // Stats from the last Update()
+            int MovedBalls;
+
+            SpatialGrid() : CellSize(0.0f), OriginX(0.0f), OriginY(0.0f), Cols(0), Rows(0),
+                            BallCount(0), MovedBalls(0)
+                {
+                }
+
+            // Files every ball into its cell. Rebuilds from scratch when the table, the
+            // cell size or the number of balls changed, otherwise only moves the balls
+            // that crossed into a new cell since the last call.
+            void Update(const float* x, const float* y, int count,
+                        float minX, float minY, float maxX, float maxY, float cellSize)
+                {
+                    if (cellSize <= 0.0f)
+                        cellSize = 1.0f;
+
+                    int cols = (int)ceil((maxX - minX) / cellSize) + 1;
+                    int rows = (int)ceil((maxY - minY) / cellSize) + 1;
+
+                    if (count != this->BallCount || cellSize != this->CellSize || cols != this->Cols ||
+                        rows != this->Rows || minX != this->OriginX || minY != this->OriginY)
+                        {
+                            this->rebuild(x, y, count, minX, minY, cols, rows, cellSize);
+                            return;
+                        }
+
+                    this->MovedBalls = 0;
+                    for (int i = 0; i < count; i++)
+                        {
+                            int cell = this->CellOf(x[i], y[i]);
+                            if (cell == this->BallCell[i])
+                                continue;
+
+                            this->remove(i);
+                            this->insert(i, cell);
+                            this->MovedBalls++;
+                        }
+                }
+
+            // Collects every pair of balls in the same or adjacent cells
+            void FindCandidatePairs(vector<BallPair>& pairs) const
+                {
+                    pairs.clear();
+                    for (int row = 0; row < this->Rows; row++)
+                        for (int col = 0; col < this->Cols; col++)
+                            {
+                                const vector<int>& cell = this->Cells[row * this->Cols + col];
+                                if (cell.empty())
+                                    continue;
+
+                                // Pairs inside this cell
+                                for (size_t i = 0; i < cell.size(); i++)
+                                    for (size_t j = i + 1; j < cell.size(); j++)
+                                        pairs.push_back(BallPair{ cell[i], cell[j] });
+
+                                // Pairs with the four "forward" neighbours
+                                this->pairWithCell(cell, col + 1, row,     pairs);
+                                this->pairWithCell(cell, col - 1, row + 1, pairs);
+                                this->pairWithCell(cell, col,     row + 1, pairs);
+                                this->pairWithCell(cell, col + 1, row + 1, pairs);
+                            }
+                }
+
+            // Cell index for a point; points off the table are clamped to the border cells
+            int CellOf(float px, float py) const
+                {
+                    int col = (int)((px - this->OriginX) / this->CellSize);
+                    int row = (int)((py - this->OriginY) / this->CellSize);
+                    col = col < 0 ? 0 : (col >= this->Cols ? this->Cols - 1 : col);
+                    row = row < 0 ? 0 : (row >= this->Rows ? this->Rows - 1 : row);
+                    return row * this->Cols + col;
+                }
+
+        private:
+            void rebuild(const float* x, const float* y, int count,
+                         float minX, float minY, int cols, int rows, float cellSize)
+                {
+                    this->CellSize = cellSize;
+                    this->OriginX = minX;
+                    this->OriginY = minY;
+                    this->Cols = cols;
+                    this->Rows = rows;
+                    this->BallCount = count;
+
+                    this->Cells.resize((size_t)cols * rows);
+                    for (size_t c = 0; c < this->Cells.size(); c++)
+                        this->Cells[c].clear();
+                    this->BallCell.resize(count);
+                    this->BallSlot.resize(count);
+
+                    for (int i = 0; i < count; i++)
+                        this->insert(i, this->CellOf(x[i], y[i]));
+                    this->MovedBalls = count;
+                }
+
+            void insert(int ball, int cell)
+                {
+                    this->BallCell[ball] = cell;
+                    this->BallSlot[ball] = (int)this->Cells[cell].size();
+                    this->Cells[cell].push_back(ball);
+                }
+
+            // Swap-removes a ball from its cell list, fixing up the slot of the ball moved into its place
+            void remove(int ball)
+                {
+                    vector<int>& cell = this->Cells[this->BallCell[ball]];
+                    int slot = this->BallSlot[ball];
+                    int last = cell.back();
+                    cell[slot] = last;
+                    this->BallSlot[last] = slot;
+                    cell.pop_back();
+                }
+
+            void pairWithCell(const vector<int>& cell, int col, int row, vector<BallPair>& pairs) const
+                {
+                    if (col < 0 || col >= this->Cols || row >= this->Rows)
+                        return;
+
+                    const vector<int>& other = this->Cells[row * this->Cols + col];
+                    for (size_t i = 0; i < cell.size(); i++)
+                        for (size_t j = 0; j < other.size(); j++)
+                            pairs.push_back(BallPair{ cell[i], other[j] });
+                }
+    };
@@ -0,0 +1,244 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstring>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "profiler.h"
+
+
+// ====================================================================
+//  StreamBuffer - ring buffer for data that is rewritten every frame
+//  (instance transforms, per-frame uniforms, debug geometry).
+//
+//  The buffer is split into STREAM_BUFFER_FRAMES regions, one per frame
+//  in flight. Each frame allocates linearly from its own region, and
+//  EndFrame drops a fence behind the frame's draws. When the ring comes
+//  back round to a region, BeginFrame waits on that fence, so the CPU
+//  never overwrites data the GPU is still reading and the driver never
+//  has to reallocate or stall behind our back.
+//
+//  With GL 4.4 / ARB_buffer_storage the buffer is mapped once, persistent
+//  and coherent, and Allocate hands out pointers straight into GPU-visible
+//  memory. Without it Allocate writes to a CPU copy and Flush() sends the
+//  new bytes with one glBufferSubData; call Flush() before drawing from
+//  anything allocated (it costs nothing on the persistent path).
+//
+//  Upload() copies data in and, when the frame's region is full, spills
+//  it into overflow buffers instead. Those are appended to for the rest
+//  of the frame and only re-specified the first time they are used in
+//  a frame, so queued draws still reading earlier spills (RenderQueue
+//  executes after everything is submitted) never see them overwritten.
+// ====================================================================
+
+
+const int        STREAM_BUFFER_FRAMES       = 3;
+const GLsizeiptr STREAM_BUFFER_FRAME_BYTES  = 4 * 1024 * 1024;
+const GLsizeiptr STREAM_BUFFER_SPILL_BYTES  = 1024 * 1024;      // Smallest overflow buffer
+
+
+struct StreamAllocation
+    {
+        void*    Ptr;       // Where to write (NULL if the frame's region is full)
+        GLintptr Offset;    // Where that is in Buffer
+    };
+
+
+class StreamBuffer
+    {
+        public:
+            GLuint Buffer;
+            bool   Persistent;              // Mapped persistently (vs. the glBufferSubData fallback)
+            GLint  UniformAlignment;        // Offset alignment glBindBufferRange needs for uniform blocks
+
+            // Stats
+            unsigned int Stalls;            // Frames that had to wait for the GPU to release their region
+            unsigned int Overflows;         // Allocations that didn't fit in the frame's region
+
+            StreamBuffer() : Buffer(0), Persistent(false), UniformAlignment(256), Stalls(0), Overflows(0),
+                             frameBytes(0), mapped(NULL), region(0), head(0), end(0), flushed(0), frame(0), spill(0)
+                {
+                    for (int i = 0; i < STREAM_BUFFER_FRAMES; i++)
+                        this->fences[i] = 0;
+                }
+
+            // Creates the ring with `frameBytes` for each frame in flight (needs a GL context)
+            void Create(GLsizeiptr frameBytes = STREAM_BUFFER_FRAME_BYTES)
+                {
+                    this->frameBytes = frameBytes;
+                    GLsizeiptr total = frameBytes * STREAM_BUFFER_FRAMES;
+                    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &this->UniformAlignment);
+
+                    glGenBuffers(1, &this->Buffer);
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, this->Buffer);
+
+                    this->Persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+                    if (this->Persistent)
+                        {
+                            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                            glBufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags);
+                            this->mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+                        }
+                    else
+                        {
+                            glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_STREAM_DRAW);
+                            this->shadow.resize((size_t)total);
+                            this->mapped = &this->shadow[0];
+                        }
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+                    this->region = 0;
+                    this->head = this->flushed = 0;
+                    this->end = frameBytes;
+                }
+
+            // Moves on to the next region, waiting for the GPU if it is still reading it
+            void BeginFrame()
+                {
+                    this->region = (this->region + 1) % STREAM_BUFFER_FRAMES;
+                    GLsync fence = this->fences[this->region];
+                    if (fence)
+                        {
+                            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                                {
+                                    PROFILE_SCOPE("StreamBuffer stall");
+                                    this->Stalls++;
+                                    GLenum result;
+                                    do
+                                        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);     // 1ms
+                                    while (result == GL_TIMEOUT_EXPIRED);
+                                }
+                            glDeleteSync(fence);
+                            this->fences[this->region] = 0;
+                        }
+
+                    this->head = this->flushed = this->region * this->frameBytes;
+                    this->end = this->head + this->frameBytes;
+
+                    // The overflow buffers start over, each re-specified when it is first used
+                    this->frame++;
+                    this->spill = 0;
+                }
+
+            // Reserves `bytes` in this frame's region, starting on a multiple of `alignment`
+            StreamAllocation Allocate(GLsizeiptr bytes, GLsizeiptr alignment = 16)
+                {
+                    StreamAllocation allocation = { NULL, 0 };
+                    if (this->mapped == NULL)
+                        return allocation;
+
+                    GLintptr offset = (this->head + alignment - 1) / alignment * alignment;
+                    if (offset + bytes > this->end)
+                        {
+                            this->Overflows++;
+                            return allocation;
+                        }
+
+                    this->head = offset + bytes;
+                    allocation.Ptr = this->mapped + offset;
+                    allocation.Offset = offset;
+                    return allocation;
+                }
+
+            // Copies `bytes` of `data` into this frame's region, or into an overflow buffer if
+            // the region is full (or the ring was never created). Returns the buffer the data
+            // ended up in and sets `offset` to where; it stays put until the next BeginFrame.
+            GLuint Upload(const void* data, GLsizeiptr bytes, GLsizeiptr alignment, GLintptr& offset)
+                {
+                    StreamAllocation allocation = this->Allocate(bytes, alignment);
+                    if (allocation.Ptr != NULL)
+                        {
+                            memcpy(allocation.Ptr, data, bytes);
+                            this->Flush();
+                            offset = allocation.Offset;
+                            return this->Buffer;
+                        }
+
+                    // Append to the first overflow buffer with room left this frame
+                    for (; this->spill < this->spills.size(); this->spill++)
+                        {
+                            SpillBuffer& spill = this->spills[this->spill];
+                            if (spill.Frame != this->frame)
+                                {
+                                    // First use this frame: orphan last frame's contents
+                                    glBindBuffer(GL_COPY_WRITE_BUFFER, spill.Buffer);
+                                    glBufferData(GL_COPY_WRITE_BUFFER, spill.Size, NULL, GL_STREAM_DRAW);
+                                    spill.Frame = this->frame;
+                                    spill.Head = 0;
+                                }
+                            GLintptr start = (spill.Head + alignment - 1) / alignment * alignment;
+                            if (start + bytes <= spill.Size)
+                                {
+                                    glBindBuffer(GL_COPY_WRITE_BUFFER, spill.Buffer);
+                                    glBufferSubData(GL_COPY_WRITE_BUFFER, start, bytes, data);
+                                    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                                    spill.Head = start + bytes;
+                                    offset = start;
+                                    return spill.Buffer;
+                                }
+                        }
+
+                    // None has room: add one, kept for the frames to come
+                    SpillBuffer spill;
+                    spill.Size = bytes > STREAM_BUFFER_SPILL_BYTES ? bytes : STREAM_BUFFER_SPILL_BYTES;
+                    spill.Head = bytes;
+                    spill.Frame = this->frame;
+                    glGenBuffers(1, &spill.Buffer);
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, spill.Buffer);
+                    glBufferData(GL_COPY_WRITE_BUFFER, spill.Size, NULL, GL_STREAM_DRAW);
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, bytes, data);
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                    this->spills.push_back(spill);
+                    offset = 0;
+                    return spill.Buffer;
+                }
+
+            // Makes everything allocated so far visible to the GPU
+            void Flush()
+                {
+                    if (!this->Persistent && this->head > this->flushed)
+                        {
+                            glBindBuffer(GL_COPY_WRITE_BUFFER, this->Buffer);
+                            glBufferSubData(GL_COPY_WRITE_BUFFER, this->flushed, this->head - this->flushed,
+                                            this->mapped + this->flushed);
+                            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                        }
+                    this->flushed = this->head;
+                }
+
+            // Fences the frame's region once all of its draws have been issued
+            void EndFrame()
+                {
+                    this->Flush();
+                    this->fences[this->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                }
+
+            bool Ready() const { return this->mapped != NULL; }
+
+        private:
+            struct SpillBuffer
+                {
+                    GLuint Buffer;
+                    GLsizeiptr Size;
+                    GLintptr Head;          // Next free byte
+                    unsigned int Frame;     // Frame it was last re-specified in
+                };
+
+            GLsizeiptr frameBytes;
+            unsigned char* mapped;              // Persistent mapping, or shadow
+            vector<unsigned char> shadow;       // CPU copy for the non-persistent path
+            GLsync fences[STREAM_BUFFER_FRAMES];
+            int region;
+            GLintptr head, end;                 // Next free byte / end of this frame's region
+            GLintptr flushed;                   // Everything before this has reached the GPU
+            unsigned int frame;                 // BeginFrames so far
+            vector<SpillBuffer> spills;         // Overflow buffers
+            size_t spill;                       // First one that may still have room this frame
+    };
+
+
+// The ring everything per-frame is streamed through
+StreamBuffer frameStream;
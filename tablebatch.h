@@ -0,0 +1,99 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+using namespace std;
+
+#include "timestep.h"
+#include "ballsystem.h"
+#include "ccd.h"
+
+
+// ====================================================================
+//  Batch simulation of many independent tables, with no window or GL
+//  context. Each table is simply a BallSystem; worker threads claim
+//  tables from a shared counter and run each one to the end before
+//  claiming the next, so no locking is needed and a slow table never
+//  holds up the others.
+// ====================================================================
+
+
+// Settings for a batch run
+struct TableBatchSettings
+    {
+        double SimSeconds;      // Simulated time per table
+        double TickRate;        // Physics ticks per second
+        int    Threads;         // Worker threads (0 = one per core)
+        bool   UseCCD;          // Event-driven physics instead of fixed steps
+
+        TableBatchSettings() : SimSeconds(10.0), TickRate(PHYSICS_HZ), Threads(0), UseCCD(false)
+            {
+            }
+    };
+
+
+// What a batch run reports
+struct TableBatchResult
+    {
+        int       Tables;
+        int       Threads;
+        long long Ticks;                // Physics ticks over all tables
+        double    WallSeconds;
+        double    TablesPerSecond;
+    };
+
+
+// Simulates every table in place for settings.SimSeconds, spread over all cores
+TableBatchResult SimulateTables(vector<BallSystem>& tables, const TableBatchSettings& settings)
+    {
+        int threads = settings.Threads;
+        if (threads <= 0)
+            threads = (int)thread::hardware_concurrency();
+        if (threads <= 0)
+            threads = 1;
+        if (threads > (int)tables.size())
+            threads = tables.size() > 0 ? (int)tables.size() : 1;
+
+        int ticksPerTable = (int)(settings.SimSeconds * settings.TickRate + 0.5);
+        double dt = 1.0 / settings.TickRate;
+
+        atomic<int> nextTable(0);
+        auto worker = [&]()
+            {
+                EventDrivenSimulator ccd;
+                for (int t = nextTable++; t < (int)tables.size(); t = nextTable++)
+                    {
+                        BallSystem& balls = tables[t];
+                        if (settings.UseCCD)
+                            {
+                                ccd.Reset();
+                                for (int tick = 0; tick < ticksPerTable; tick++)
+                                    ccd.Step(balls, dt);
+                            }
+                        else
+                            {
+                                for (int tick = 0; tick < ticksPerTable; tick++)
+                                    balls.Step((float)dt);
+                            }
+                    }
+            };
+
+        auto start = chrono::high_resolution_clock::now();
+        vector<thread> pool;
+        for (int i = 1; i < threads; i++)
+            pool.push_back(thread(worker));
+        worker();                                   // The calling thread works too
+        for (size_t i = 0; i < pool.size(); i++)
+            pool[i].join();
+        auto end = chrono::high_resolution_clock::now();
+
+        TableBatchResult result;
+        result.Tables = (int)tables.size();
+        result.Threads = threads;
+        result.Ticks = (long long)ticksPerTable * tables.size();
+        result.WallSeconds = chrono::duration<double>(end - start).count();
+        result.TablesPerSecond = result.WallSeconds > 0.0 ? result.Tables / result.WallSeconds : 0.0;
+        return result;
+    }
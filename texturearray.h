@@ -0,0 +1,99 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+#include <SOIL.h>
+
+#include "glstate.h"
+
+
+// ====================================================================
+//  Texture array - same-sized material textures packed as the layers
+//  of one GL_TEXTURE_2D_ARRAY.
+//
+//  Every ball on the table is the same mesh with a different picture
+//  on it. With a GL_TEXTURE_2D each, a full rack needs a texture bind
+//  per ball; with the pictures as layers of one array, the whole rack
+//  is drawn with a single binding and each instance picks its layer
+//  (InstanceData::Layer, sampled by poolBallFragment.glsl when it is
+//  compiled with SHADER_TEXTURE_ARRAY).
+//
+//  Add() loads images and hands out layers; Upload() then sends them
+//  all to the GPU at once. Every layer has to be the size of the first.
+// ====================================================================
+
+
+class TextureArray
+    {
+        public:
+            GLuint ID;                  // Made by the first Add, so meshes can refer to it before Upload
+            GLint Width, Height;
+            GLint Layers;
+
+            TextureArray() : ID(0), Width(0), Height(0), Layers(0) {}
+
+            // Loads the image at `path` as the next layer and returns its index, or the
+            // layer it already has. Returns -1 if it can't be read or is the wrong size.
+            GLint Add(const string& path)
+                {
+                    map<string, GLint>::iterator it = this->layerOf.find(path);
+                    if (it != this->layerOf.end())
+                        return it->second;
+
+                    int width, height;
+                    unsigned char* image = SOIL_load_image(path.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
+                    if (image == NULL)
+                        return -1;
+                    if (this->Layers > 0 && (width != this->Width || height != this->Height))
+                        {
+                            cout << "ERROR::TEXTURE_ARRAY:: " << path << " is " << width << "x" << height
+                                 << ", the other layers are " << this->Width << "x" << this->Height << endl;
+                            SOIL_free_image_data(image);
+                            return -1;
+                        }
+
+                    this->Width = width;
+                    this->Height = height;
+                    this->pixels.insert(this->pixels.end(), image, image + (size_t)width * height * 3);
+                    SOIL_free_image_data(image);
+
+                    if (this->ID == 0)
+                        glGenTextures(1, &this->ID);
+                    this->layerOf[path] = this->Layers;
+                    return this->Layers++;
+                }
+
+            // Sends every layer added so far to the GPU and frees the copies kept
+            // for it, so add everything first
+            void Upload(bool gamma = false)
+                {
+                    if (this->Layers == 0)
+                        return;
+
+                    glState.BindTexture(0, GL_TEXTURE_2D_ARRAY, this->ID);
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);      // The layers are packed RGB rows
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, gamma ? GL_SRGB : GL_RGB, this->Width, this->Height, this->Layers,
+                                 0, GL_RGB, GL_UNSIGNED_BYTE, &this->pixels[0]);
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+                    // Same sampling as TextureFromFile
+                    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                    glState.BindTexture(0, GL_TEXTURE_2D_ARRAY, 0);
+
+                    vector<unsigned char>().swap(this->pixels);
+                }
+
+        private:
+            vector<unsigned char> pixels;       // Every layer's RGB rows, waiting for Upload
+            map<string, GLint> layerOf;         // Layer each path was loaded into
+    };
@@ -0,0 +1,173 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+using namespace std;
+
+
+// ====================================================================
+//  WorkStealingPool - a fixed set of worker threads for data-parallel
+//  loops.
+//
+//  ParallelFor() cuts the index range into chunks and deals them out to
+//  a queue per worker. A worker takes chunks from the back of its own
+//  queue; when that runs dry it steals from the front of another
+//  worker's queue, so threads that get cheap chunks (e.g. candidates
+//  that were cut off early) help out with the expensive ones.
+//
+//  The calling thread works as worker 0, so a pool of N threads only
+//  starts N - 1 extra threads. The worker index is handed to the loop
+//  body so it can use per-worker scratch memory.
+// ====================================================================
+
+
+class WorkStealingPool
+    {
+        public:
+            WorkStealingPool(int threads = 0) : generation(0), pending(0), stopping(false)
+                {
+                    if (threads <= 0)
+                        threads = (int)thread::hardware_concurrency();
+                    if (threads <= 0)
+                        threads = 1;
+
+                    this->queues = vector<WorkerQueue>(threads);
+                    for (int w = 1; w < threads; w++)
+                        this->workers.push_back(thread(&WorkStealingPool::workerLoop, this, w));
+                }
+
+            ~WorkStealingPool()
+                {
+                    {
+                        lock_guard<mutex> lock(this->wakeLock);
+                        this->stopping = true;
+                    }
+                    this->wake.notify_all();
+                    for (size_t i = 0; i < this->workers.size(); i++)
+                        this->workers[i].join();
+                }
+
+            int ThreadCount() const { return (int)this->queues.size(); }
+
+            // Calls body(index, worker) for every index in [0, count), in chunks of `grain`
+            // indices, and returns once all of them are done
+            void ParallelFor(int count, int grain, const function<void(int, int)>& body)
+                {
+                    if (count <= 0)
+                        return;
+                    if (grain < 1)
+                        grain = 1;
+
+                    this->job = &body;
+                    this->pending = count;
+
+                    // Deal the chunks out round-robin
+                    int w = 0;
+                    for (int begin = 0; begin < count; begin += grain)
+                        {
+                            int end = begin + grain < count ? begin + grain : count;
+                            WorkerQueue& q = this->queues[w];
+                            lock_guard<mutex> lock(q.Lock);
+                            q.Tasks.push_back(TaskRange{ begin, end });
+                            w = (w + 1) % this->ThreadCount();
+                        }
+
+                    {
+                        lock_guard<mutex> lock(this->wakeLock);
+                        this->generation++;
+                    }
+                    this->wake.notify_all();
+
+                    // Work alongside the pool, then wait for the stragglers
+                    this->runTasks(0);
+                    while (this->pending.load() > 0)
+                        this_thread::yield();
+                    this->job = nullptr;
+                }
+
+        private:
+            struct TaskRange
+                {
+                    int Begin, End;
+                };
+
+            // A worker's chunks: the owner pops from the back, thieves take from the front (Head)
+            struct WorkerQueue
+                {
+                    mutex Lock;
+                    vector<TaskRange> Tasks;
+                    size_t Head;
+
+                    WorkerQueue() : Head(0) {}
+                    WorkerQueue(const WorkerQueue&) : Head(0) {}
+                };
+
+            vector<WorkerQueue> queues;
+            vector<thread> workers;
+            const function<void(int, int)>* job;
+
+            mutex wakeLock;
+            condition_variable wake;
+            long long generation;
+            atomic<int> pending;            // Indices not finished yet
+            bool stopping;
+
+            void workerLoop(int w)
+                {
+                    long long seen = 0;
+                    while (true)
+                        {
+                            {
+                                unique_lock<mutex> lock(this->wakeLock);
+                                this->wake.wait(lock, [&]() { return this->stopping || this->generation != seen; });
+                                if (this->stopping)
+                                    return;
+                                seen = this->generation;
+                            }
+                            this->runTasks(w);
+                        }
+                }
+
+            void runTasks(int w)
+                {
+                    TaskRange range;
+                    while (this->takeTask(w, range))
+                        {
+                            for (int i = range.Begin; i < range.End; i++)
+                                (*this->job)(i, w);
+                            this->pending -= range.End - range.Begin;
+                        }
+                }
+
+            // Pops from our own queue, or steals from the others
+            bool takeTask(int w, TaskRange& range)
+                {
+                    int n = this->ThreadCount();
+                    for (int k = 0; k < n; k++)
+                        {
+                            int victim = (w + k) % n;
+                            WorkerQueue& q = this->queues[victim];
+                            lock_guard<mutex> lock(q.Lock);
+                            if (q.Head >= q.Tasks.size())
+                                {
+                                    q.Tasks.clear();
+                                    q.Head = 0;
+                                    continue;
+                                }
+
+                            if (victim == w)
+                                {
+                                    range = q.Tasks.back();
+                                    q.Tasks.pop_back();
+                                }
+                            else
+                                range = q.Tasks[q.Head++];
+                            return true;
+                        }
+                    return false;
+                }
+    };
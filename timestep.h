@@ -0,0 +1,71 @@
+#pragma once
+// Std. Includes
+#include <cmath>
+
+// ====================================================================
+//  Fixed-timestep clock for the ball simulation.
+//
+//  The render loop passes in the real time that elapsed since the last
+//  frame, and Advance() says how many physics ticks to run. Whatever is
+//  left over (less than one tick) stays in the accumulator, and Alpha()
+//  gives that fraction so the renderer can blend between the previous
+//  and current physics states.
+//
+//  Because the tick length never changes, ball speed no longer depends
+//  on the frame rate, so we can run uncapped or with vsync.
+// ====================================================================
+
+
+// Default simulation values
+const double PHYSICS_HZ         = 120.0;    // Physics ticks per second
+const int    PHYSICS_MAX_STEPS  = 8;        // Most ticks we will run for a single frame
+
+
+class FixedTimestep
+    {
+        public:
+            double    TickRate;         // Ticks per second
+            double    Dt;               // Seconds per tick
+            int       MaxSubsteps;      // Cap on ticks per frame
+            double    Accumulator;      // Unsimulated time carried between frames
+            long long TickCount;        // Total ticks simulated so far
+            long long DroppedTicks;     // Ticks thrown away because of the cap
+
+            FixedTimestep(double hz = PHYSICS_HZ, int maxSubsteps = PHYSICS_MAX_STEPS)
+                : TickRate(hz), Dt(1.0 / hz), MaxSubsteps(maxSubsteps),
+                  Accumulator(0.0), TickCount(0), DroppedTicks(0)
+                {
+                }
+
+            // Adds the frame's elapsed time and returns the number of ticks to simulate.
+            int Advance(double frameTime)
+                {
+                    // Ignore negative times and huge stalls (e.g. dragging the window)
+                    if (frameTime < 0.0)
+                        frameTime = 0.0;
+                    if (frameTime > 0.25)
+                        frameTime = 0.25;
+
+                    this->Accumulator += frameTime;
+
+                    int steps = (int)(this->Accumulator / this->Dt);
+                    if (steps > this->MaxSubsteps)
+                        {
+                            // We can't keep up: drop the extra time rather than falling
+                            // further behind every frame (the "spiral of death").
+                            this->DroppedTicks += steps - this->MaxSubsteps;
+                            steps = this->MaxSubsteps;
+                            this->Accumulator = steps * this->Dt + fmod(this->Accumulator, this->Dt);
+                        }
+
+                    this->Accumulator -= steps * this->Dt;
+                    this->TickCount += steps;
+                    return steps;
+                }
+
+            // How far we are between the last tick and the next one, from 0 to 1
+            double Alpha() const
+                {
+                    return this->Accumulator / this->Dt;
+                }
+    };
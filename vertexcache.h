@@ -0,0 +1,283 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+using namespace std;
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+
+// ====================================================================
+//  Load-time mesh optimisation, run on every Mesh by Model::processMesh:
+//
+//   1. WeldVertices            - Assimp gives each triangle corner its own
+//                                vertex; identical ones are merged so the
+//                                GPU can reuse a transformed vertex.
+//   2. OptimizeVertexCache     - reorders triangles so vertices are reused
+//                                while still in the post-transform cache
+//                                (Tipsify, Sander, Nehab and Barczak 2007).
+//   3. OptimizeOverdraw        - reorders Tipsify's clusters so outward
+//                                facing parts of the mesh are drawn first
+//                                and hide more of what comes after.
+//   4. OptimizeVertexFetch     - renumbers vertices in the order the index
+//                                list first uses them, so fetches walk the
+//                                vertex buffer forwards.
+//
+//  ACMR (average cache miss ratio: vertices transformed per triangle, 0.5
+//  at best, 3 with no reuse at all) measures how well steps 1 and 2 worked.
+// ====================================================================
+
+
+const int VERTEX_CACHE_SIZE = 16;       // Entries in the FIFO post-transform cache we optimise for
+
+
+// Vertices transformed per triangle with a FIFO cache of `cacheSize` entries
+GLfloat ComputeACMR(const vector<GLuint>& indices, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE)
+    {
+        if (indices.empty())
+            return 0.0f;
+
+        vector<int> cachedAt(vertexCount, -1000000);    // Miss count when each vertex last went into the cache
+        int misses = 0;
+        for (size_t i = 0; i < indices.size(); i++)
+            {
+                GLuint v = indices[i];
+                if (misses - cachedAt[v] >= cacheSize)  // Pushed out by cacheSize newer misses
+                    {
+                        cachedAt[v] = misses;
+                        misses++;
+                    }
+            }
+        return (GLfloat)misses / (indices.size() / 3);
+    }
+
+
+// Merges vertices whose every byte is the same and rewrites the indices to match
+template <typename VertexT>
+void WeldVertices(vector<VertexT>& vertices, vector<GLuint>& indices)
+    {
+        unordered_map<unsigned long long, vector<GLuint> > buckets;
+        vector<GLuint> remap(vertices.size());
+        vector<VertexT> welded;
+        welded.reserve(vertices.size());
+
+        for (size_t v = 0; v < vertices.size(); v++)
+            {
+                // FNV-1a over the vertex's bytes
+                const unsigned char* bytes = (const unsigned char*)&vertices[v];
+                unsigned long long hash = 14695981039346656037ULL;
+                for (size_t b = 0; b < sizeof(VertexT); b++)
+                    hash = (hash ^ bytes[b]) * 1099511628211ULL;
+
+                vector<GLuint>& bucket = buckets[hash];
+                GLuint found = (GLuint)-1;
+                for (size_t i = 0; i < bucket.size(); i++)
+                    if (memcmp(&welded[bucket[i]], &vertices[v], sizeof(VertexT)) == 0)
+                        {
+                            found = bucket[i];
+                            break;
+                        }
+
+                if (found == (GLuint)-1)
+                    {
+                        found = (GLuint)welded.size();
+                        welded.push_back(vertices[v]);
+                        bucket.push_back(found);
+                    }
+                remap[v] = found;
+            }
+
+        for (size_t i = 0; i < indices.size(); i++)
+            indices[i] = remap[indices[i]];
+        vertices.swap(welded);
+    }
+
+
+// Tipsify: walks the mesh fanning around one vertex at a time, moving next to a
+// neighbour that is still in the cache. Fills `clusterStarts` with the triangle
+// each run starts on, where the walk hit a dead end and had to jump elsewhere.
+void OptimizeVertexCache(vector<GLuint>& indices, size_t vertexCount, vector<size_t>* clusterStarts = NULL,
+                         int cacheSize = VERTEX_CACHE_SIZE)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        // Triangles around each vertex
+        vector<GLuint> offset(vertexCount + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++)
+            offset[indices[i] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offset[v + 1] += offset[v];
+        vector<GLuint> adjacency(indices.size());
+        vector<GLuint> fill(offset.begin(), offset.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = (GLuint)(i / 3);
+
+        vector<int> live(vertexCount);                  // Triangles not yet emitted, per vertex
+        for (size_t v = 0; v < vertexCount; v++)
+            live[v] = offset[v + 1] - offset[v];
+
+        vector<int> cacheTime(vertexCount, -cacheSize - 1);
+        vector<unsigned char> emitted(triangleCount, 0);
+        vector<GLuint> deadEnd;                         // Recently used vertices, to restart from
+        vector<GLuint> candidates;
+        vector<GLuint> output;
+        output.reserve(indices.size());
+
+        int time = cacheSize + 1;
+        size_t cursor = 0;
+        int fan = 0;
+        if (clusterStarts)
+            clusterStarts->assign(1, 0);
+
+        while (fan >= 0)
+            {
+                // Emit every remaining triangle around `fan`
+                candidates.clear();
+                for (GLuint a = offset[fan]; a < offset[fan + 1]; a++)
+                    {
+                        GLuint t = adjacency[a];
+                        if (emitted[t])
+                            continue;
+                        for (int k = 0; k < 3; k++)
+                            {
+                                GLuint v = indices[t * 3 + k];
+                                output.push_back(v);
+                                deadEnd.push_back(v);
+                                candidates.push_back(v);
+                                live[v]--;
+                                if (time - cacheTime[v] > cacheSize)
+                                    cacheTime[v] = time++;
+                            }
+                        emitted[t] = 1;
+                    }
+
+                // Next fan: the candidate that will still be in the cache after its own triangles
+                // go out, and of those the one that has been there longest
+                int next = -1, bestPriority = -1;
+                for (size_t i = 0; i < candidates.size(); i++)
+                    {
+                        GLuint v = candidates[i];
+                        if (live[v] <= 0)
+                            continue;
+                        int priority = 0;
+                        if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                            priority = time - cacheTime[v];
+                        if (priority > bestPriority)
+                            {
+                                bestPriority = priority;
+                                next = (int)v;
+                            }
+                    }
+
+                if (next < 0)
+                    {
+                        // Dead end: restart from a recent vertex, or failing that the next unfinished one
+                        while (!deadEnd.empty() && next < 0)
+                            {
+                                GLuint v = deadEnd.back();
+                                deadEnd.pop_back();
+                                if (live[v] > 0)
+                                    next = (int)v;
+                            }
+                        while (next < 0 && cursor < vertexCount)
+                            {
+                                if (live[cursor] > 0)
+                                    next = (int)cursor;
+                                cursor++;
+                            }
+                        if (next >= 0 && clusterStarts && output.size() / 3 < triangleCount)
+                            clusterStarts->push_back(output.size() / 3);
+                    }
+                fan = next;
+            }
+
+        indices.swap(output);
+    }
+
+
+// Sorts the clusters found by OptimizeVertexCache so the ones facing most
+// outwards from the mesh's centre come first. Within a cluster the order -
+// and so most of the cache efficiency - is kept.
+template <typename VertexT>
+void OptimizeOverdraw(vector<GLuint>& indices, const vector<VertexT>& vertices, const vector<size_t>& clusterStarts)
+    {
+        size_t triangleCount = indices.size() / 3;
+        size_t clusterCount = clusterStarts.size();
+        if (clusterCount < 2)
+            return;
+
+        // Area-weighted centre of the mesh
+        glm::vec3 meshCentre(0.0f);
+        float meshArea = 0.0f;
+        vector<glm::vec3> centre(clusterCount, glm::vec3(0.0f)), normal(clusterCount, glm::vec3(0.0f));
+        vector<float> area(clusterCount, 0.0f);
+        for (size_t c = 0; c < clusterCount; c++)
+            {
+                size_t end = c + 1 < clusterCount ? clusterStarts[c + 1] : triangleCount;
+                for (size_t t = clusterStarts[c]; t < end; t++)
+                    {
+                        const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+                        const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+                        const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+                        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);      // Length is twice the area
+                        float a = glm::length(n);
+                        centre[c] = centre[c] + (p0 + p1 + p2) * (a / 3.0f);
+                        normal[c] = normal[c] + n;
+                        area[c] += a;
+                    }
+                meshCentre = meshCentre + centre[c];
+                meshArea += area[c];
+            }
+        if (meshArea <= 0.0f)
+            return;
+        meshCentre = meshCentre * (1.0f / meshArea);
+
+        // How far out each cluster sits along its own average normal
+        vector<float> outwards(clusterCount, 0.0f);
+        vector<size_t> order(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++)
+            {
+                order[c] = c;
+                float length = glm::length(normal[c]);
+                if (area[c] > 0.0f && length > 0.0f)
+                    outwards[c] = glm::dot(centre[c] * (1.0f / area[c]) - meshCentre, normal[c] * (1.0f / length));
+            }
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return outwards[a] > outwards[b]; });
+
+        vector<GLuint> output;
+        output.reserve(indices.size());
+        for (size_t i = 0; i < clusterCount; i++)
+            {
+                size_t c = order[i];
+                size_t end = c + 1 < clusterCount ? clusterStarts[c + 1] : triangleCount;
+                output.insert(output.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + end * 3);
+            }
+        indices.swap(output);
+    }
+
+
+// Renumbers vertices in the order the indices first reach them (unused ones are dropped)
+template <typename VertexT>
+void OptimizeVertexFetch(vector<VertexT>& vertices, vector<GLuint>& indices)
+    {
+        vector<GLuint> remap(vertices.size(), (GLuint)-1);
+        vector<VertexT> ordered;
+        ordered.reserve(vertices.size());
+        for (size_t i = 0; i < indices.size(); i++)
+            {
+                GLuint& v = indices[i];
+                if (remap[v] == (GLuint)-1)
+                    {
+                        remap[v] = (GLuint)ordered.size();
+                        ordered.push_back(vertices[v]);
+                    }
+                v = remap[v];
+            }
+        vertices.swap(ordered);
+    }